@@ -0,0 +1,193 @@
+﻿#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "zdict.h"
+#include "ZstdContext.hpp"
+#include "DictionaryLibrary.hpp"
+
+// "MSDL" in little-endian order
+static const uint32_t LIBRARY_MAGIC = 0x4C44534D;
+static const uint32_t LIBRARY_VERSION = 1;
+// Bound on the size of a dictionary read from a library, protecting against corrupted files
+static const uint64_t MAX_DICTIONARY_SIZE = 64 << 20;
+// Range of the IDs ZDICT gives to trained dictionaries; the rest is reserved by the Zstandard format
+static const uint32_t MIN_TRAINED_ID = 32768;
+static const uint32_t MAX_TRAINED_ID = 0x7FFFFFFF;
+// Offset of the ID in a dictionary, after the magic number
+static const size_t DICTIONARY_ID_OFFSET = 4;
+
+bool DictionaryLibrary::load(const std::string& libraryFile) {
+	std::ifstream ifs(libraryFile, std::ios::binary);
+	if (!ifs) {
+		return false;
+	}
+
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	uint32_t count = 0;
+	ifs.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	ifs.read(reinterpret_cast<char*>(&version), sizeof(version));
+	ifs.read(reinterpret_cast<char*>(&count), sizeof(count));
+	if (!ifs || magic != LIBRARY_MAGIC || version != LIBRARY_VERSION) {
+		return false;
+	}
+
+	dictionaries.clear();
+	for (uint32_t i = 0; i < count; ++i) {
+		LibraryDictionary dictionary;
+		uint16_t clanLength = 0;
+		uint64_t dataSize = 0;
+		ifs.read(reinterpret_cast<char*>(&clanLength), sizeof(clanLength));
+		dictionary.clan.resize(clanLength);
+		ifs.read(&dictionary.clan[0], clanLength);
+		ifs.read(reinterpret_cast<char*>(&dictionary.id), sizeof(dictionary.id));
+		ifs.read(reinterpret_cast<char*>(&dataSize), sizeof(dataSize));
+		if (!ifs || dataSize > MAX_DICTIONARY_SIZE) {
+			return false;
+		}
+		dictionary.data.resize(dataSize);
+		ifs.read(dictionary.data.data(), dataSize);
+		if (!ifs) {
+			return false;
+		}
+		dictionaries.push_back(std::move(dictionary));
+	}
+	return true;
+}
+
+bool DictionaryLibrary::save(const std::string& libraryFile) const {
+	std::ofstream ofs(libraryFile, std::ios::binary);
+	if (!ofs) {
+		return false;
+	}
+
+	uint32_t count = static_cast<uint32_t>(dictionaries.size());
+	ofs.write(reinterpret_cast<const char*>(&LIBRARY_MAGIC), sizeof(LIBRARY_MAGIC));
+	ofs.write(reinterpret_cast<const char*>(&LIBRARY_VERSION), sizeof(LIBRARY_VERSION));
+	ofs.write(reinterpret_cast<const char*>(&count), sizeof(count));
+	for (const auto& dictionary : dictionaries) {
+		uint16_t clanLength = static_cast<uint16_t>(dictionary.clan.size());
+		uint64_t dataSize = dictionary.data.size();
+		ofs.write(reinterpret_cast<const char*>(&clanLength), sizeof(clanLength));
+		ofs.write(dictionary.clan.data(), clanLength);
+		ofs.write(reinterpret_cast<const char*>(&dictionary.id), sizeof(dictionary.id));
+		ofs.write(reinterpret_cast<const char*>(&dataSize), sizeof(dataSize));
+		ofs.write(dictionary.data.data(), dataSize);
+	}
+	return static_cast<bool>(ofs);
+}
+
+// Compares two dictionaries apart from their IDs, which add may have changed.
+static bool haveSameContent(const std::vector<char>& a, const std::vector<char>& b) {
+	size_t idEnd = DICTIONARY_ID_OFFSET + sizeof(uint32_t);
+	return a.size() == b.size() && std::equal(a.begin(), a.begin() + DICTIONARY_ID_OFFSET, b.begin())
+		&& std::equal(a.begin() + idEnd, a.end(), b.begin() + idEnd);
+}
+
+bool DictionaryLibrary::add(const std::string& clan, std::vector<char>& data) {
+	uint32_t id = ZDICT_getDictID(data.data(), data.size());
+	if (id == 0) {
+		return false;
+	}
+
+	LibraryDictionary dictionary;
+	dictionary.clan = clan;
+	// the ID is derived from the content, so clans trained on the same samples get the same dictionary
+	for (const LibraryDictionary* existing = findById(id); existing != NULL; existing = findById(id)) {
+		if (haveSameContent(existing->data, data)) {
+			dictionary.id = id;
+			dictionaries.push_back(std::move(dictionary));
+			return true;
+		}
+		id = id < MAX_TRAINED_ID ? id + 1 : MIN_TRAINED_ID;
+	}
+	for (size_t i = 0; i < sizeof(id); ++i) {
+		data[DICTIONARY_ID_OFFSET + i] = static_cast<char>(id >> (8 * i));
+	}
+
+	dictionary.id = id;
+	dictionary.data.swap(data);
+	dictionaries.push_back(std::move(dictionary));
+	return true;
+}
+
+const LibraryDictionary* DictionaryLibrary::findByClan(const std::string& clan) const {
+	for (const auto& dictionary : dictionaries) {
+		if (dictionary.clan == clan) {
+			return dictionary.data.empty() ? findById(dictionary.id) : &dictionary;
+		}
+	}
+	return NULL;
+}
+
+const LibraryDictionary* DictionaryLibrary::findById(uint32_t id) const {
+	for (const auto& dictionary : dictionaries) {
+		if (dictionary.id == id && !dictionary.data.empty()) {
+			return &dictionary;
+		}
+	}
+	return NULL;
+}
+
+std::string findClan(const std::vector<std::string>& headers) {
+	for (const auto& header : headers) {
+		std::istringstream iss(header);
+		std::string marker, feature, clan;
+		iss >> marker >> feature >> clan;
+		if (marker == "#=GF" && feature == "CL") {
+			return clan;
+		}
+	}
+	return std::string();
+}
+
+namespace {
+
+struct SharedDictionaries {
+	std::mutex mutex;
+	std::map<std::string, std::unique_ptr<DictionaryLibrary>> libraries;
+	std::map<std::pair<std::string, uint32_t>, DecompressionDictionary> dictionaries;
+};
+
+SharedDictionaries& sharedDictionaries() {
+	static SharedDictionaries shared;
+	return shared;
+}
+
+}
+
+const ZSTD_DDict* sharedDecompressionDictionary(const std::string& libraryFile, uint32_t id) {
+	SharedDictionaries& shared = sharedDictionaries();
+	std::lock_guard<std::mutex> lock(shared.mutex);
+
+	auto key = std::make_pair(libraryFile, id);
+	auto found = shared.dictionaries.find(key);
+	if (found != shared.dictionaries.end()) {
+		return found->second.get();
+	}
+
+	std::unique_ptr<DictionaryLibrary>& library = shared.libraries[libraryFile];
+	if (!library) {
+		std::unique_ptr<DictionaryLibrary> loaded(new DictionaryLibrary());
+		if (!loaded->load(libraryFile)) {
+			shared.libraries.erase(libraryFile);
+			return NULL;
+		}
+		library.swap(loaded);
+	}
+
+	const LibraryDictionary* dictionary = library->findById(id);
+	if (dictionary == NULL) {
+		return NULL;
+	}
+	DecompressionDictionary digested(ZSTD_createDDict(dictionary->data.data(), dictionary->data.size()));
+	if (!digested) {
+		return NULL;
+	}
+	const ZSTD_DDict* result = digested.get();
+	shared.dictionaries[key] = std::move(digested);
+	return result;
+}
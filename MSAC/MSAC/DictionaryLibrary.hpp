@@ -0,0 +1,71 @@
+﻿#ifndef DICTIONARYLIBRARY_HPP
+#define DICTIONARYLIBRARY_HPP
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "zstd.h"
+
+/**
+ * Structure to represent a dictionary of a library, trained on the families of one clan.
+ */
+struct LibraryDictionary {
+    std::string clan;                       // Clan accession from the #=GF CL header, empty for families outside any clan
+    uint32_t id;                            // Zstandard dictionary ID, by which archives reference the dictionary
+    std::vector<char> data;                 // Content of the dictionary, empty if the clan shares the dictionary of another clan with the same ID
+};
+
+/**
+ * Set of dictionaries kept in a file apart from the archives, one per clan, so that many small families
+ * share a dictionary instead of each archive training and storing its own.
+ */
+class DictionaryLibrary {
+private:
+    std::vector<LibraryDictionary> dictionaries;
+
+public:
+    /**
+     * Reads the dictionaries of a library file. Returns false if the file cannot be read or is not a library.
+     */
+    bool load(const std::string& libraryFile);
+
+    /**
+     * Writes the dictionaries to a library file. Returns false if the file cannot be written.
+     */
+    bool save(const std::string& libraryFile) const;
+
+    /**
+     * Adds the dictionary of a clan. A clan whose dictionary equals one already added shares it; a dictionary
+     * whose ID is taken by a different one gets the next free ID. Returns false if the dictionary has no ID.
+     */
+    bool add(const std::string& clan, std::vector<char>& data);
+
+    /**
+     * Returns the dictionary of the given clan, or NULL if the library has none. A shared dictionary is returned
+     * with the clan of the first clan using it.
+     */
+    const LibraryDictionary* findByClan(const std::string& clan) const;
+
+    /**
+     * Returns the dictionary with the given ID, or NULL if the library has none.
+     */
+    const LibraryDictionary* findById(uint32_t id) const;
+
+    size_t size() const {
+        return dictionaries.size();
+    }
+};
+
+/**
+ * Returns the clan accession from the #=GF CL line of Stockholm headers, or an empty string if there is none.
+ */
+std::string findClan(const std::vector<std::string>& headers);
+
+/**
+ * Returns the digested dictionary with the given ID from a library file. The library is read and the dictionary
+ * digested on first use, then both are kept for the lifetime of the process and shared by all threads and archives.
+ * Returns NULL if the library cannot be read or has no such dictionary.
+ */
+const ZSTD_DDict* sharedDecompressionDictionary(const std::string& libraryFile, uint32_t id);
+
+#endif
@@ -0,0 +1,269 @@
+﻿#include <cstdint>
+#include <cstring>
+#include "GapScan.hpp"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define GAPSCAN_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC accepts any intrinsic in any function; GCC and Clang need the instruction set enabled per function.
+#if defined(_MSC_VER) && !defined(__clang__)
+#define GAPSCAN_TARGET(isa)
+#else
+#define GAPSCAN_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+typedef size_t(*ScanKernel)(const char* data, size_t begin, size_t end);
+
+struct GapScanKernels {
+	ScanKernel findGap;
+	ScanKernel skipGaps;
+	ScanKernel findCountOrRowEnd;
+};
+
+static inline bool isCountOrRowEnd(char c) {
+	return (c >= '0' && c <= '9') || c == '#' || c == '\0';
+}
+
+static size_t findGapScalar(const char* data, size_t begin, size_t end) {
+	const void* gap = begin < end ? std::memchr(data + begin, '.', end - begin) : NULL;
+	return gap != NULL ? static_cast<const char*>(gap) - data : end;
+}
+
+static size_t skipGapsScalar(const char* data, size_t begin, size_t end) {
+	while (begin < end && data[begin] == '.') {
+		++begin;
+	}
+	return begin;
+}
+
+static size_t findCountOrRowEndScalar(const char* data, size_t begin, size_t end) {
+	while (begin < end && !isCountOrRowEnd(data[begin])) {
+		++begin;
+	}
+	return begin;
+}
+
+#ifdef GAPSCAN_X86
+
+static inline unsigned countTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+static inline unsigned countTrailingZeros(uint64_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__) && defined(_M_X64)
+	unsigned long index;
+	_BitScanForward64(&index, mask);
+	return index;
+#elif defined(_MSC_VER) && !defined(__clang__)
+	uint32_t low = static_cast<uint32_t>(mask);
+	return low != 0 ? countTrailingZeros(low) : 32 + countTrailingZeros(static_cast<uint32_t>(mask >> 32));
+#else
+	return __builtin_ctzll(mask);
+#endif
+}
+
+GAPSCAN_TARGET("sse2")
+static size_t findGapSse2(const char* data, size_t begin, size_t end) {
+	const __m128i gap = _mm_set1_epi8('.');
+	for (; begin + 16 <= end; begin += 16) {
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + begin));
+		uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, gap)));
+		if (mask != 0) {
+			return begin + countTrailingZeros(mask);
+		}
+	}
+	return findGapScalar(data, begin, end);
+}
+
+GAPSCAN_TARGET("sse2")
+static size_t skipGapsSse2(const char* data, size_t begin, size_t end) {
+	const __m128i gap = _mm_set1_epi8('.');
+	for (; begin + 16 <= end; begin += 16) {
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + begin));
+		uint32_t mask = ~static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, gap))) & 0xFFFFu;
+		if (mask != 0) {
+			return begin + countTrailingZeros(mask);
+		}
+	}
+	return skipGapsScalar(data, begin, end);
+}
+
+GAPSCAN_TARGET("sse2")
+static size_t findCountOrRowEndSse2(const char* data, size_t begin, size_t end) {
+	const __m128i zeroDigit = _mm_set1_epi8('0');
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i separator = _mm_set1_epi8('#');
+	const __m128i terminator = _mm_setzero_si128();
+	for (; begin + 16 <= end; begin += 16) {
+		__m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + begin));
+		__m128i digitOffset = _mm_sub_epi8(chunk, zeroDigit);
+		__m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(digitOffset, nine), digitOffset);
+		__m128i isRowEnd = _mm_or_si128(_mm_cmpeq_epi8(chunk, separator), _mm_cmpeq_epi8(chunk, terminator));
+		uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_or_si128(isDigit, isRowEnd)));
+		if (mask != 0) {
+			return begin + countTrailingZeros(mask);
+		}
+	}
+	return findCountOrRowEndScalar(data, begin, end);
+}
+
+GAPSCAN_TARGET("avx2")
+static size_t findGapAvx2(const char* data, size_t begin, size_t end) {
+	const __m256i gap = _mm256_set1_epi8('.');
+	for (; begin + 32 <= end; begin += 32) {
+		__m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + begin));
+		uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, gap)));
+		if (mask != 0) {
+			return begin + countTrailingZeros(mask);
+		}
+	}
+	return findGapSse2(data, begin, end);
+}
+
+GAPSCAN_TARGET("avx2")
+static size_t skipGapsAvx2(const char* data, size_t begin, size_t end) {
+	const __m256i gap = _mm256_set1_epi8('.');
+	for (; begin + 32 <= end; begin += 32) {
+		__m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + begin));
+		uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, gap)));
+		if (mask != 0) {
+			return begin + countTrailingZeros(mask);
+		}
+	}
+	return skipGapsSse2(data, begin, end);
+}
+
+GAPSCAN_TARGET("avx2")
+static size_t findCountOrRowEndAvx2(const char* data, size_t begin, size_t end) {
+	const __m256i zeroDigit = _mm256_set1_epi8('0');
+	const __m256i nine = _mm256_set1_epi8(9);
+	const __m256i separator = _mm256_set1_epi8('#');
+	const __m256i terminator = _mm256_setzero_si256();
+	for (; begin + 32 <= end; begin += 32) {
+		__m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + begin));
+		__m256i digitOffset = _mm256_sub_epi8(chunk, zeroDigit);
+		__m256i isDigit = _mm256_cmpeq_epi8(_mm256_min_epu8(digitOffset, nine), digitOffset);
+		__m256i isRowEnd = _mm256_or_si256(_mm256_cmpeq_epi8(chunk, separator), _mm256_cmpeq_epi8(chunk, terminator));
+		uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_or_si256(isDigit, isRowEnd)));
+		if (mask != 0) {
+			return begin + countTrailingZeros(mask);
+		}
+	}
+	return findCountOrRowEndSse2(data, begin, end);
+}
+
+GAPSCAN_TARGET("avx512f,avx512bw")
+static size_t findGapAvx512(const char* data, size_t begin, size_t end) {
+	const __m512i gap = _mm512_set1_epi8('.');
+	for (; begin + 64 <= end; begin += 64) {
+		__m512i chunk = _mm512_loadu_si512(reinterpret_cast<const void*>(data + begin));
+		uint64_t mask = _mm512_cmpeq_epi8_mask(chunk, gap);
+		if (mask != 0) {
+			return begin + countTrailingZeros(mask);
+		}
+	}
+	return findGapAvx2(data, begin, end);
+}
+
+GAPSCAN_TARGET("avx512f,avx512bw")
+static size_t skipGapsAvx512(const char* data, size_t begin, size_t end) {
+	const __m512i gap = _mm512_set1_epi8('.');
+	for (; begin + 64 <= end; begin += 64) {
+		__m512i chunk = _mm512_loadu_si512(reinterpret_cast<const void*>(data + begin));
+		uint64_t mask = _mm512_cmpneq_epi8_mask(chunk, gap);
+		if (mask != 0) {
+			return begin + countTrailingZeros(mask);
+		}
+	}
+	return skipGapsAvx2(data, begin, end);
+}
+
+GAPSCAN_TARGET("avx512f,avx512bw")
+static size_t findCountOrRowEndAvx512(const char* data, size_t begin, size_t end) {
+	const __m512i zeroDigit = _mm512_set1_epi8('0');
+	const __m512i nine = _mm512_set1_epi8(9);
+	const __m512i separator = _mm512_set1_epi8('#');
+	const __m512i terminator = _mm512_setzero_si512();
+	for (; begin + 64 <= end; begin += 64) {
+		__m512i chunk = _mm512_loadu_si512(reinterpret_cast<const void*>(data + begin));
+		uint64_t mask = _mm512_cmple_epu8_mask(_mm512_sub_epi8(chunk, zeroDigit), nine)
+			| _mm512_cmpeq_epi8_mask(chunk, separator)
+			| _mm512_cmpeq_epi8_mask(chunk, terminator);
+		if (mask != 0) {
+			return begin + countTrailingZeros(mask);
+		}
+	}
+	return findCountOrRowEndAvx2(data, begin, end);
+}
+
+#endif
+
+static GapScanKernels selectKernels() {
+	GapScanKernels kernels = { findGapScalar, skipGapsScalar, findCountOrRowEndScalar };
+#ifdef GAPSCAN_X86
+	bool sse2 = false;
+	bool avx2 = false;
+	bool avx512bw = false;
+#if defined(_MSC_VER) && !defined(__clang__)
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	__cpuid(info, 1);
+	sse2 = (info[3] & (1 << 26)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	uint64_t enabledStates = osxsave ? _xgetbv(0) : 0;
+	if (maxLeaf >= 7) {
+		__cpuidex(info, 7, 0);
+		avx2 = avx && (enabledStates & 0x6) == 0x6 && (info[1] & (1 << 5)) != 0;
+		avx512bw = (enabledStates & 0xE6) == 0xE6 && (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0;
+	}
+#else
+	__builtin_cpu_init();
+	sse2 = __builtin_cpu_supports("sse2");
+	avx2 = __builtin_cpu_supports("avx2");
+	avx512bw = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#endif
+	if (avx512bw) {
+		GapScanKernels selected = { findGapAvx512, skipGapsAvx512, findCountOrRowEndAvx512 };
+		kernels = selected;
+	}
+	else if (avx2) {
+		GapScanKernels selected = { findGapAvx2, skipGapsAvx2, findCountOrRowEndAvx2 };
+		kernels = selected;
+	}
+	else if (sse2) {
+		GapScanKernels selected = { findGapSse2, skipGapsSse2, findCountOrRowEndSse2 };
+		kernels = selected;
+	}
+#endif
+	return kernels;
+}
+
+static const GapScanKernels& gapScanKernels() {
+	static const GapScanKernels kernels = selectKernels();
+	return kernels;
+}
+
+size_t findGap(const char* data, size_t begin, size_t end) {
+	return gapScanKernels().findGap(data, begin, end);
+}
+
+size_t skipGaps(const char* data, size_t begin, size_t end) {
+	return gapScanKernels().skipGaps(data, begin, end);
+}
+
+size_t findCountOrRowEnd(const char* data, size_t begin, size_t end) {
+	return gapScanKernels().findCountOrRowEnd(data, begin, end);
+}
@@ -0,0 +1,27 @@
+﻿#ifndef GAPSCAN_HPP
+#define GAPSCAN_HPP
+
+#include <cstddef>
+
+/**
+ * Vectorized scanning kernels used by the gap-reducing preprocessing methods.
+ * The widest kernel supported by the CPU (AVX-512BW, AVX2, SSE2 or scalar) is selected at first use.
+ */
+
+/**
+ * Returns the index of the first gap ('.') in data[begin, end), or end if there is none.
+ */
+size_t findGap(const char* data, size_t begin, size_t end);
+
+/**
+ * Returns the index of the first character other than a gap ('.') in data[begin, end), or end if there is none.
+ */
+size_t skipGaps(const char* data, size_t begin, size_t end);
+
+/**
+ * Returns the index of the first digit, row separator ('#') or '\0' in data[begin, end), or end if there is none.
+ * Used to find the end of a run of residues in data encoded with preprocessing method A.
+ */
+size_t findCountOrRowEnd(const char* data, size_t begin, size_t end);
+
+#endif
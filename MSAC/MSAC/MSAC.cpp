@@ -9,7 +9,9 @@
 #include <unordered_map>
 #include <cctype>
 #include <chrono>
+#include <thread>
 #include "MSACompressor.hpp"
+#include "QueryServer.hpp"
 
 int main(int argc, char* argv[]) {
 	MSACompressor compressor;
@@ -24,13 +26,66 @@ int main(int argc, char* argv[]) {
 	int A = 200000;
 	int B = 9000;
 	PreprocessingType preprocessingType = PreprocessingType::REDUCE_GAPS_A;
-	int pos = 0;
+	int threads = 1;
+	size_t dictionarySize = 0;
+	bool verticalMatches = false;
+	int windowLog = 0;
+	int strategy = 0;
+	bool longDistanceMatching = false;
+	bool literalsOnly = false;
+	int tileGroupSize = 1;
+	bool sequentialOutput = false;
+	size_t cacheMegabytes = 256;
+	std::string dictionaryLibrary;
+	TuningConstraints constraints = { 0, 0, 0 };
+	std::vector<std::string> arguments;
+	bool queryMode = mode == "Ds" || mode == "Dsr" || mode == "Dc" || mode == "Drc" || mode == "Db";
 
-	if (mode == "Sc") {
+	if (mode == "Sc" || mode == "Lc" || mode == "Tc") {
+		// Lc takes the library file and then the input files, all of them before the options
+		if (mode == "Lc") {
+			arguments.push_back(outFile);
+		}
 		for (int i = 4; i < argc; ++i) {
 			std::string arg = argv[i];
 
-			if (arg.substr(0, 2) == "-a") {
+			if (mode == "Lc" && arg[0] != '-') {
+				arguments.push_back(arg);
+			}
+			else if (arg.substr(0, 2) == "-L") {
+				dictionaryLibrary = arg.substr(2);
+			}
+			else if (mode == "Tc" && arg.substr(0, 2) == "-C") {
+				constraints.minCompressionSpeed = std::stod(arg.substr(2));
+			}
+			else if (mode == "Tc" && arg.substr(0, 2) == "-Q") {
+				constraints.maxSequenceLatency = std::stod(arg.substr(2));
+			}
+			else if (mode == "Tc" && arg.substr(0, 2) == "-M") {
+				constraints.maxMemory = std::stod(arg.substr(2));
+			}
+			else if (arg == "-v") {
+				verticalMatches = true;
+			}
+			else if (arg == "-H") {
+				literalsOnly = true;
+			}
+			else if (arg == "-l") {
+				longDistanceMatching = true;
+			}
+			else if (arg.substr(0, 2) == "-w") {
+				windowLog = std::stoi(arg.substr(2));
+				ZSTD_bounds bounds = ZSTD_cParam_getBounds(ZSTD_c_windowLog);
+				if (windowLog != 0 && windowLog < bounds.lowerBound) windowLog = bounds.lowerBound;
+				if (windowLog > bounds.upperBound) windowLog = bounds.upperBound;
+			}
+			else if (arg.substr(0, 2) == "-s") {
+				strategy = std::stoi(arg.substr(2));
+				ZSTD_bounds bounds = ZSTD_cParam_getBounds(ZSTD_c_strategy);
+				if (strategy != 0 && strategy < bounds.lowerBound) strategy = bounds.lowerBound;
+				if (strategy > bounds.upperBound) strategy = bounds.upperBound;
+			}
+			else if (arg.substr(0, 2) == "-a") {
 				A = std::stoi(arg.substr(2));
 				if (A < 1) A = 1;
 			}
@@ -40,8 +95,23 @@ int main(int argc, char* argv[]) {
 			}
 			else if (arg.substr(0, 2) == "-z") {
 				zstdLevel = std::stoi(arg.substr(2));
-				if (zstdLevel < 1) zstdLevel = 1;
-				if (zstdLevel > 19) zstdLevel = 19;
+				if (zstdLevel < ZSTD_minCLevel()) zstdLevel = ZSTD_minCLevel();
+				if (zstdLevel > ZSTD_maxCLevel()) zstdLevel = ZSTD_maxCLevel();
+			}
+			else if (arg.substr(0, 2) == "-G") {
+				tileGroupSize = std::stoi(arg.substr(2));
+				if (tileGroupSize < 1) tileGroupSize = 1;
+			}
+			else if (arg.substr(0, 2) == "-T") {
+				threads = std::stoi(arg.substr(2));
+				if (threads < 1) threads = std::thread::hardware_concurrency();
+				if (threads < 1) threads = 1;
+			}
+			else if (arg.substr(0, 2) == "-d") {
+				int dictionaryKilobytes = std::stoi(arg.substr(2));
+				if (dictionaryKilobytes < 0) dictionaryKilobytes = 0;
+				if (dictionaryKilobytes > 4096) dictionaryKilobytes = 4096;
+				dictionarySize = static_cast<size_t>(dictionaryKilobytes) * 1024;
 			}
 			else if (arg.substr(0, 2) == "-p") {
 				int pType = std::stoi(arg.substr(2));
@@ -64,6 +134,15 @@ int main(int argc, char* argv[]) {
 				case 5:
 					preprocessingType = PreprocessingType::REDUCE_GAPS_AND_UPPERCASE;
 					break;
+				case 6:
+					preprocessingType = PreprocessingType::BWT_MTF;
+					break;
+				case 7:
+					preprocessingType = PreprocessingType::BWT_MTF_BY_COLUMN;
+					break;
+				case 8:
+					preprocessingType = PreprocessingType::AUTO_PREPROCESSING;
+					break;
 				default:
 					compressor.printUsage();
 					exit(1);
@@ -76,9 +155,29 @@ int main(int argc, char* argv[]) {
 		}
 	}
 	else {
+		// the server answers requests on all cores unless -T says otherwise
+		if (mode == "serve") {
+			threads = std::thread::hardware_concurrency();
+			if (threads < 1) threads = 1;
+		}
 		for (int i = 4; i < argc; ++i) {
 			std::string arg = argv[i];
-			if (arg.substr(0, 2) == "-p") {
+			if (arg.substr(0, 2) == "-L") {
+				dictionaryLibrary = arg.substr(2);
+			}
+			else if (mode == "Sd" && arg == "-S") {
+				sequentialOutput = true;
+			}
+			else if ((mode == "serve" || queryMode) && arg.substr(0, 2) == "-K") {
+				int megabytes = std::stoi(arg.substr(2));
+				cacheMegabytes = megabytes < 0 ? 0 : megabytes;
+			}
+			else if ((mode == "Sd" || mode == "serve") && arg.substr(0, 2) == "-T") {
+				threads = std::stoi(arg.substr(2));
+				if (threads < 1) threads = std::thread::hardware_concurrency();
+				if (threads < 1) threads = 1;
+			}
+			else if (arg.substr(0, 2) == "-p") {
 				int pType = std::stoi(arg.substr(2));
 				switch (pType) {
 				case 0:
@@ -99,60 +198,85 @@ int main(int argc, char* argv[]) {
 				case 5:
 					preprocessingType = PreprocessingType::REDUCE_GAPS_AND_UPPERCASE;
 					break;
+				case 6:
+					preprocessingType = PreprocessingType::BWT_MTF;
+					break;
+				case 7:
+					preprocessingType = PreprocessingType::BWT_MTF_BY_COLUMN;
+					break;
+				case 8:
+					preprocessingType = PreprocessingType::AUTO_PREPROCESSING;
+					break;
 				default:
 					compressor.printUsage();
 					exit(1);
 				}
-				pos=i;
+			}
+			else {
+				arguments.push_back(arg);
 			}
 		}
 	}
+	compressor.setDictionaryLibrary(dictionaryLibrary);
+	if (queryMode) {
+		compressor.getTileCache().setCapacity(cacheMegabytes * 1024 * 1024);
+	}
 
 	if (mode == "Sc") {
-		compressor.compress(inFile, outFile, zstdLevel, A, B, preprocessingType);
+		CompressionOptions options = { zstdLevel, A, B, preprocessingType, threads, dictionarySize, verticalMatches, windowLog, strategy, longDistanceMatching, literalsOnly, tileGroupSize };
+		compressor.compress(inFile, outFile, options);
 		std::cout << "File compressed successfully." << std::endl;
 	}
+	else if (mode == "Tc") {
+		CompressionOptions options = { zstdLevel, A, B, preprocessingType, threads, dictionarySize, verticalMatches, windowLog, strategy, longDistanceMatching, literalsOnly, tileGroupSize };
+		compressor.tune(inFile, outFile, options, constraints);
+		if (outFile != "-") {
+			std::cout << "File compressed successfully." << std::endl;
+		}
+	}
+	else if (mode == "Lc") {
+		CompressionOptions options = { zstdLevel, A, B, preprocessingType, threads, dictionarySize, verticalMatches, windowLog, strategy, longDistanceMatching, literalsOnly, tileGroupSize };
+		compressor.buildDictionaryLibrary(inFile, arguments, options);
+		std::cout << "Dictionary library built successfully." << std::endl;
+	}
 	else if (mode == "Sd") {
-		compressor.decompress(inFile, outFile, preprocessingType);
-		std::cout << "File decompressed successfully." << std::endl;
+		compressor.decompress(inFile, outFile, preprocessingType, threads, sequentialOutput);
+		if (outFile != "-") {
+			std::cout << "File decompressed successfully." << std::endl;
+		}
 	}
 	else if (mode == "Ds") {
-		std::vector<std::string> sequenceIds;
-		std::string id;
-		for (int i = 4; i < argc; i++)
-		{
-			if (i != pos) {
-				id = argv[i];
-				sequenceIds.push_back(id);
-			}
+		compressor.decompressSequences(inFile, outFile, arguments, preprocessingType);
+		std::cout << "File decompressed successfully." << std::endl;
+	}
+	else if (mode == "Dsr") {
+		if (arguments.size() < 2) {
+			compressor.printUsage();
+			return 1;
 		}
-		compressor.decompressSequences(inFile, outFile, sequenceIds, preprocessingType);
+		int startId = atoi(arguments[0].c_str());
+		int stopId = atoi(arguments[1].c_str());
+		std::vector<std::string> chosenSequenceIds(arguments.begin() + 2, arguments.end());
+		compressor.decompressSequenceRange(inFile, outFile, chosenSequenceIds, startId, stopId, preprocessingType);
 		std::cout << "File decompressed successfully." << std::endl;
 	}
 	else if (mode == "Dc") {
 		std::vector<int> columnsIds;
-		int id;
-		for (int i = 4; i < argc; i++)
+		for (const auto& argument : arguments)
 		{
-			if (i != pos) {
-				id = atoi(argv[i]);
-				columnsIds.push_back(id);
-			}
+			columnsIds.push_back(atoi(argument.c_str()));
 		}
 		compressor.decompressColumns(inFile, outFile, columnsIds, preprocessingType);
 		std::cout << "File decompressed successfully." << std::endl;
 	}
 	else if (mode == "Drc") {
 		std::vector<int> columnsIds;
-		int startId, stopId;
-		if (pos == 0) {
-			startId = atoi(argv[4]);
-			stopId = atoi(argv[5]);
-		}
-		else {
-			startId = atoi(argv[5]);
-			stopId = atoi(argv[6]);
+		if (arguments.size() < 2) {
+			compressor.printUsage();
+			return 1;
 		}
+		int startId = atoi(arguments[0].c_str());
+		int stopId = atoi(arguments[1].c_str());
 		for (int i = startId; i < stopId + 1; i++)
 		{
 			columnsIds.push_back(i);
@@ -160,6 +284,17 @@ int main(int argc, char* argv[]) {
 		compressor.decompressColumns(inFile, outFile, columnsIds, preprocessingType);
 		std::cout << "File decompressed successfully." << std::endl;
 	}
+	else if (mode == "Db") {
+		compressor.decompressBatch(inFile, outFile, preprocessingType);
+		std::cout << "Queries answered successfully." << std::endl;
+	}
+	else if (mode == "serve") {
+		// the archives follow the socket file
+		arguments.insert(arguments.begin(), outFile);
+		QueryServer server(arguments, preprocessingType, cacheMegabytes * 1024 * 1024);
+		server.serve(inFile, threads);
+		return 1;
+	}
 	else {
 		std::cerr << "Invalid mode." << std::endl;
 		compressor.printUsage();
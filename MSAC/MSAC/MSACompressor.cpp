@@ -6,545 +6,1305 @@
 #include <map>
 #include <set>
 #include <unordered_map>
+#include <unordered_set>
 #include <cctype>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <deque>
+#include <memory>
+#include <cstdio>
+#include <chrono>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <sys/stat.h>
+#endif
+#define ZSTD_STATIC_LINKING_ONLY
 #include "zstd.h"
+#include "zdict.h"
+#include "divsufsort.h"
+#include "Preprocessing.hpp"
+#include "ZstdContext.hpp"
+#include "VerticalMatches.hpp"
+#include "MappedFile.hpp"
+#include "DictionaryLibrary.hpp"
+#include "TileCodec.hpp"
 #include "MSACompressor.hpp"
 
+// Trailer marker of versioned files ("MSAC" read as little endian). Their trailer records the dictionary, the library
+// dictionary ID, the Zstandard parameters and the tile group size, and their footer entries the preprocessing and codec.
+static const uint32_t ARCHIVE_MAGIC = 0x4341534D;
+static const uint32_t ARCHIVE_VERSION = 1;
+
+// Flags of the recorded Zstandard parameters
+static const uint32_t PARAMETER_LONG_DISTANCE_MATCHING = 1;
+static const uint32_t PARAMETER_VERTICAL_MATCHES = 2;
+// Size of the recorded Zstandard parameters: level, window log, strategy and flags
+static const uint64_t PARAMETERS_SIZE = 3 * sizeof(int32_t) + sizeof(uint32_t);
+
+// Dictionaries are trained on about DICTIONARY_SAMPLE_RATIO times their size of serialized rows
+static const size_t DICTIONARY_SAMPLE_RATIO = 100;
+// Dictionary size used when building a library without -d, the default of the zstd command line tool
+static const size_t DEFAULT_LIBRARY_DICTIONARY_SIZE = 112 * 1024;
+
+// Memory kept for the cells of the rectangles that later identical rectangles are compared with
+static const size_t DUPLICATE_CANDIDATE_BYTES = 256 * 1024 * 1024;
+
+// Decompressed sequences are written as the ID padded to ID_COLUMN_WIDTH, a space and the aligned sequence
+static const uint64_t ID_COLUMN_WIDTH = 25;
+#ifdef _WIN32
+static const char NEWLINE[] = "\r\n";
+#else
+static const char NEWLINE[] = "\n";
+#endif
+static const size_t NEWLINE_LENGTH = sizeof(NEWLINE) - 1;
+
+// Output file name selecting the standard output
+static const char STANDARD_OUTPUT[] = "-";
+
+// Returns the size of the column holding the sequence ID at the start of a decompressed line, including the separating space.
+static size_t idColumnSize(const std::string& id) {
+	return std::max<size_t>(id.size(), ID_COLUMN_WIDTH) + 1;
+}
 
-void MSACompressor::applyPreprocessing(Rectangle& rect, PreprocessingType preprocessingType) {
-	switch (preprocessingType) {
-	case NO_PREPROCESSING:
-		break;
-	case REDUCE_GAPS_A:
-		reduceGapsA(rect);
-		break;
-	case REDUCE_GAPS_B:
-		reduceGapsB(rect);
-		break;
-	case REDUCE_GAPS_C:
-		reduceGapsC(rect);
-		break;
-	case REDUCE_GAPS_AND_LOWERCASE:
-		reduceGapsAndLowerCase(rect);
-		break;
-	case REDUCE_GAPS_AND_UPPERCASE:
-		reduceGapsAndUpperCase(rect);
-		break;
-	}
+// Writes the ID column of a decompressed line.
+static void writeIdColumn(char* out, const std::string& id) {
+	std::memcpy(out, id.data(), id.size());
+	std::memset(out + id.size(), ' ', idColumnSize(id) - id.size());
 }
 
-void MSACompressor::reversePreprocessing(Rectangle& rect, PreprocessingType preprocessingType, const std::vector<std::string>& sequenceIds) {
-	switch (preprocessingType) {
-	case NO_PREPROCESSING:
-		decompressRectangle(rect, sequenceIds);
-		//decompressRectangleByColumn(rect, sequenceIds);
-		break;
-	case REDUCE_GAPS_A:
-		reverseGapsA(rect, sequenceIds);
-		break;
-	case REDUCE_GAPS_B:
-		reverseGapsB(rect, sequenceIds);
-		break;
-	case REDUCE_GAPS_C:
-		reverseGapsC(rect, sequenceIds);
-		break;
-	case REDUCE_GAPS_AND_LOWERCASE:
-		reverseGapsA(rect, sequenceIds);
-		break;
-	case REDUCE_GAPS_AND_UPPERCASE:
-		reverseGapsA(rect, sequenceIds);
-		break;
-	}
+// Writes a line followed by the newline and returns the position after it.
+static char* writeLine(char* out, const std::string& line) {
+	std::memcpy(out, line.data(), line.size());
+	std::memcpy(out + line.size(), NEWLINE, NEWLINE_LENGTH);
+	return out + line.size() + NEWLINE_LENGTH;
 }
 
-void MSACompressor::compressRectangle(Rectangle& rect, int zstdLevel, PreprocessingType preprocessingType) {
+// Switches a standard stream to binary mode, so that newlines are written as they are.
+static void setBinaryMode(FILE* stream) {
+#ifdef _WIN32
+	_setmode(_fileno(stream), _O_BINARY);
+#else
+	(void)stream;
+#endif
+}
 
-	applyPreprocessing(rect, preprocessingType);
+// Returns whether the output can be memory-mapped, i.e. it is not the standard output, a pipe or a device.
+static bool isMappableOutput(const std::string& outputFile) {
+	if (outputFile == STANDARD_OUTPUT) {
+		return false;
+	}
+#ifndef _WIN32
+	struct stat status;
+	if (stat(outputFile.c_str(), &status) == 0 && !S_ISREG(status.st_mode)) {
+		return false;
+	}
+#endif
+	return true;
+}
 
-	std::string rectData;
-	for (const auto& seq : rect.sequences) {
-		for (const auto& data : seq.data) {
-			rectData.push_back(data);
+// Rectangles with more rows are trial-compressed on AUTO_SAMPLE_BLOCKS evenly spaced blocks of AUTO_SAMPLE_BLOCK_ROWS rows
+static const int AUTO_SAMPLE_BLOCKS = 4;
+static const int AUTO_SAMPLE_BLOCK_ROWS = 128;
+
+// The tune mode measures configurations on the first TUNE_SAMPLE_SIZE bytes of rows, changing one setting at a time
+// among the candidates below for at most TUNE_MAX_ROUNDS rounds. The first row and column candidates stand for whole bands and rows.
+static const size_t TUNE_SAMPLE_SIZE = 2 << 20;
+static const int TUNE_MAX_ROUNDS = 4;
+static const int TUNE_ROW_CANDIDATES[] = { 200000, 1, 10, 50, 200, 1000, 5000 };
+static const int TUNE_COLUMN_CANDIDATES[] = { 100000, 250, 1000, 3000, 9000 };
+static const int TUNE_LEVEL_CANDIDATES[] = { -5, 1, 3, 9, 13, 19 };
+static const PreprocessingType TUNE_PREPROCESSING_CANDIDATES[] = { NO_PREPROCESSING, REDUCE_GAPS_A, REDUCE_GAPS_B, REDUCE_GAPS_C, BWT_MTF, BWT_MTF_BY_COLUMN };
+// Number of bands decoded to measure the latency of Ds, and the size of a footer entry added to each rectangle
+static const int TUNE_LATENCY_BANDS = 4;
+static const uint64_t TUNE_FOOTER_ENTRY_SIZE = 4 * sizeof(int) + sizeof(uint64_t) + 2 * sizeof(uint8_t);
+
+// Returns the kernels used to decompress rectangles of the given preprocessing type, reporting types that cannot be decompressed.
+static const PreprocessingKernels* findDecompressionKernels(PreprocessingType preprocessingType) {
+	const PreprocessingKernels* kernels = findPreprocessingKernels(preprocessingType);
+	if (kernels == NULL) {
+		if (preprocessingType == AUTO_PREPROCESSING) {
+			std::cerr << "Error: The compressed file does not record its preprocessing, specify it with -p." << std::endl;
+		}
+		else {
+			std::cerr << "Error: Unknown preprocessing type of a rectangle: " << preprocessingType << std::endl;
 		}
-		rectData += '#';
 	}
-	rect.compressedData.resize(ZSTD_compressBound(rectData.size()));
-	size_t compressedSize = ZSTD_compress(rect.compressedData.data(), rect.compressedData.size(), rectData.data(), rectData.size(), zstdLevel);
-	if (ZSTD_isError(compressedSize)) {
-		std::cerr << "Compression error: " << ZSTD_getErrorName(compressedSize) << std::endl;
-		return;
+	return kernels;
+}
+
+// Makes a decode buffer hold a given number of bytes, keeping its storage when it is large enough.
+static char* resizeDecodeBuffer(DecodeBuffer& buffer, size_t size) {
+	if (size > buffer.capacity) {
+		buffer.data.reset(new char[size]);
+		buffer.capacity = size;
 	}
-	rect.compressedData.resize(compressedSize);
+	buffer.size = size;
+	return buffer.data.get();
 }
 
-void MSACompressor::compressRectangleByColumn(Rectangle& rect, int zstdLevel, PreprocessingType preprocessingType) {
+bool MSACompressor::decompressRectangleData(const Rectangle& rect, bool burrowsWheeler, DecodeBuffer& data, std::vector<char>* chain) {
+	if (rect.codec == FILL_CODEC) {
+		// a filled rectangle has no serialized data and ends the chain
+		if (chain != NULL) {
+			chain->clear();
+		}
+		data.size = 0;
+		return true;
+	}
+	const TileCodecKernels* codec = findTileCodec(rect.codec);
+	if (codec == NULL) {
+		std::cerr << "Decompression error: Unknown codec of a rectangle: " << rect.codec << std::endl;
+		return false;
+	}
+	unsigned long long frameSize = codec->contentSize(rect.compressedData.data(), rect.compressedData.size());
+	if (frameSize == ZSTD_CONTENTSIZE_ERROR || frameSize == ZSTD_CONTENTSIZE_UNKNOWN) {
+		std::cerr << "Decompression error: Unable to determine the size of rectangle data." << std::endl;
+		return false;
+	}
+	if (frameSize > SIZE_MAX) {
+		std::cerr << "Decompression error: Rectangle data too large: " << frameSize << std::endl;
+		return false;
+	}
+	char* destination = resizeDecodeBuffer(data, static_cast<size_t>(frameSize));
+	ZSTD_DCtx* dctx = NULL;
+	const ZSTD_DDict* dictionary = NULL;
+	if (codec->zstdFrame) {
+		dctx = threadDecompressionContext(archiveParameters.windowLog);
+		dictionary = decompressionDictionary;
+		if (chain != NULL && !chain->empty()) {
+			// the prefix replaces the dictionary for this frame only
+			ZSTD_DCtx_refPrefix(dctx, chain->data(), chain->size());
+			dictionary = NULL;
+		}
+	}
+	size_t decompressedSize = codec->decompress(dctx, dictionary, rect.compressedData.data(), rect.compressedData.size(), destination, data.size);
+	if (ZSTD_isError(decompressedSize)) {
+		std::cerr << "Decompression error: " << ZSTD_getErrorName(decompressedSize) << std::endl;
+		if (chain != NULL) {
+			chain->clear();
+		}
+		return false;
+	}
+	if (chain != NULL) {
+		chain->assign(destination, destination + decompressedSize);
+	}
+	data.size = decompressedSize;
+
+	if (burrowsWheeler) {
+		static thread_local DecodeBuffer restored;
+		if (!reverseBurrowsWheelerTransform(destination, decompressedSize, restored)) {
+			return false;
+		}
+		std::swap(data, restored);
+	}
+	return true;
+}
 
-	applyPreprocessing(rect, preprocessingType);
+// Gives a rectangle that could not be decoded rows of blanks, as the full decompression writes its cells.
+static void blankSequences(Rectangle& rect, int rowCount, const std::vector<std::string>& sequenceIds) {
+	rect.sequences.clear();
+	for (int row = 0; row < rowCount; ++row) {
+		Sequence seq;
+		seq.id = sequenceIds[rect.startX + row];
+		seq.data.assign(std::max(rect.height, 0), ' ');
+		rect.sequences.push_back(std::move(seq));
+	}
+}
 
-	std::string rectData;
-	for (int i = 0; i < rect.height; i++) {
-		for (const auto& seq : rect.sequences) {
-			rectData.push_back(seq.data[i]);
+void MSACompressor::reversePreprocessing(Rectangle& rect, PreprocessingType preprocessingType, const std::vector<std::string>& sequenceIds, std::vector<char>* chain) {
+	if (rect.codec == FILL_CODEC) {
+		char symbol = rect.compressedData.empty() ? ' ' : rect.compressedData[0];
+		for (int row = 0; row < rect.width; ++row) {
+			Sequence seq;
+			seq.id = sequenceIds[rect.startX + row];
+			seq.data.assign(rect.height, symbol);
+			rect.sequences.push_back(std::move(seq));
+		}
+		if (chain != NULL) {
+			chain->clear();
 		}
-		rectData += '#';
+		return;
 	}
-	rect.compressedData.resize(ZSTD_compressBound(rectData.size()));
-	size_t compressedSize = ZSTD_compress(rect.compressedData.data(), rect.compressedData.size(), rectData.data(), rectData.size(), zstdLevel);
-	if (ZSTD_isError(compressedSize)) {
-		std::cerr << "Compression error: " << ZSTD_getErrorName(compressedSize) << std::endl;
+	const PreprocessingKernels* kernels = findDecompressionKernels(preprocessingType);
+	static thread_local DecodeBuffer decompressedData;
+	if (kernels == NULL || !decompressRectangleData(rect, kernels->burrowsWheeler, decompressedData, chain)) {
+		blankSequences(rect, rect.width, sequenceIds);
 		return;
 	}
-	rect.compressedData.resize(compressedSize);
+	kernels->deserialize(rect, decompressedData.data.get(), decompressedData.size, sequenceIds);
 }
 
-void MSACompressor::reduceGapsA(Rectangle& rect) {
-	for (auto& seq : rect.sequences) {
-		std::ostringstream result;
-		char lastChar = '\0';
-		int dotCount = 0;
-		if (seq.data[0] == '.') {
-			lastChar = '.';
-			dotCount = -1;
+void MSACompressor::decodeRectangle(const Rectangle& rect, PreprocessingType preprocessingType, char* const* rows, std::vector<char>* chain) {
+	if (rect.codec == FILL_CODEC) {
+		char symbol = rect.compressedData.empty() ? ' ' : rect.compressedData[0];
+		for (int row = 0; row < rect.width; ++row) {
+			std::memset(rows[row], symbol, rect.height);
 		}
-
-		for (char ch : seq.data) {
-			if (ch != '.') {
-				if (lastChar != '\0') {
-					result << lastChar;
-					if (dotCount > 0) {
-						result << dotCount;
-					}
-				}
-				lastChar = ch;
-				dotCount = 0;
-			}
-			else if (ch == '.') {
-				++dotCount;
-			}
+		if (chain != NULL) {
+			chain->clear();
 		}
-
-		if (lastChar != '\0') {
-			result << lastChar;
-			if (dotCount > 0) {
-				result << dotCount;
-			}
+		return;
+	}
+	const PreprocessingKernels* kernels = findDecompressionKernels(preprocessingType);
+	static thread_local DecodeBuffer decompressedData;
+	if (kernels == NULL || !decompressRectangleData(rect, kernels->burrowsWheeler, decompressedData, chain)) {
+		for (int row = 0; row < rect.width; ++row) {
+			std::memset(rows[row], ' ', rect.height);
 		}
-
-		std::string transformedData = result.str();
-		seq.data.assign(transformedData.begin(), transformedData.end());
+		return;
 	}
+	kernels->decodeRows(rect, decompressedData.data.get(), decompressedData.size, rows);
 }
 
-void MSACompressor::reduceGapsB(Rectangle& rect) {
-	for (auto& seq : rect.sequences) {
-		std::ostringstream result;
-		std::ostringstream positions;
-		char lastChar = '\0';
-		int dotCount = 0;
-		int counter = 0;
-		if (seq.data[0] == '.') {
-			lastChar = '.';
-			dotCount = -1;
-			positions << counter << ',';
+void MSACompressor::reverseLeadingRows(Rectangle& rect, PreprocessingType preprocessingType, int rowCount, const std::vector<std::string>& sequenceIds, std::vector<char>* chain) {
+	static thread_local DecodeBuffer decompressedData;
+
+	const PreprocessingKernels* kernels = findDecompressionKernels(preprocessingType);
+	const TileCodecKernels* codec = findTileCodec(rect.codec);
+	if (kernels == NULL || !kernels->leadingRows || codec == NULL || !codec->zstdFrame || rowCount >= rect.width) {
+		reversePreprocessing(rect, preprocessingType, sequenceIds, chain);
+		return;
+	}
+	unsigned long long frameSize = codec->contentSize(rect.compressedData.data(), rect.compressedData.size());
+	if (frameSize == ZSTD_CONTENTSIZE_ERROR || frameSize == ZSTD_CONTENTSIZE_UNKNOWN || frameSize > SIZE_MAX) {
+		std::cerr << "Decompression error: Unable to determine the size of rectangle data." << std::endl;
+		if (chain != NULL) {
+			chain->clear();
 		}
+		blankSequences(rect, rowCount, sequenceIds);
+		return;
+	}
+	char* destination = resizeDecodeBuffer(decompressedData, static_cast<size_t>(frameSize));
 
-		for (char ch : seq.data) {
-			if (ch != '.') {
-				if (lastChar != '\0') {
-					result << lastChar;
-					if (dotCount > 0) {
-						positions << dotCount << ',';
-					}
-				}
-				lastChar = ch;
-				dotCount = 0;
-			}
-			else if (ch == '.') {
-				if (dotCount == 0) {
-					positions << counter << ',';
-				}
-				++dotCount;
+	ZSTD_DCtx* dctx = threadDecompressionContext(archiveParameters.windowLog);
+	ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+	if (chain != NULL && !chain->empty()) {
+		ZSTD_DCtx_refPrefix(dctx, chain->data(), chain->size());
+	}
+	else {
+		ZSTD_DCtx_refDDict(dctx, decompressionDictionary);
+	}
+
+	// zstd decodes whole blocks, so the output is requested one stream chunk at a time and scanned for row ends
+	ZSTD_inBuffer input = { rect.compressedData.data(), rect.compressedData.size(), 0 };
+	ZSTD_outBuffer output = { destination, 0, 0 };
+	int rowEnds = 0;
+	size_t result = 1;
+	while (rowEnds < rowCount && result != 0 && output.pos < decompressedData.size) {
+		size_t scanned = output.pos;
+		output.size = std::min(decompressedData.size, output.pos + ZSTD_DStreamOutSize());
+		result = ZSTD_decompressStream(dctx, &output, &input);
+		if (ZSTD_isError(result)) {
+			std::cerr << "Decompression error: " << ZSTD_getErrorName(result) << std::endl;
+			break;
+		}
+		if (output.pos == scanned && input.pos == input.size) {
+			break;
+		}
+		for (const char* end = destination + scanned; rowEnds < rowCount; ++rowEnds, ++end) {
+			end = static_cast<const char*>(std::memchr(end, '#', destination + output.pos - end));
+			if (end == NULL) {
+				break;
 			}
-			++counter;
 		}
+	}
+	// the referenced dictionary would otherwise stay in use for the next frames of the context
+	ZSTD_DCtx_reset(dctx, ZSTD_reset_session_only);
+	ZSTD_DCtx_refDDict(dctx, NULL);
+	if (chain != NULL) {
+		chain->clear();
+	}
+	if (ZSTD_isError(result)) {
+		blankSequences(rect, rowCount, sequenceIds);
+		return;
+	}
 
-		if (lastChar != '\0') {
-			result << lastChar;
-			if (dotCount > 0) {
-				positions << dotCount;
+	rect.width = rowCount;
+	kernels->deserialize(rect, destination, output.pos, sequenceIds);
+}
+
+// Returns whether all the symbols of a rectangle being compressed are the same.
+static bool holdsSingleSymbol(const Rectangle& rect) {
+	if (rect.width == 0 || rect.height == 0) {
+		return false;
+	}
+	char symbol = rect.rows[0][0];
+	for (const char* row : rect.rows) {
+		for (int column = 0; column < rect.height; ++column) {
+			if (row[column] != symbol) {
+				return false;
 			}
 		}
-
-		std::string transformedPositions = positions.str();
-		std::string transformedData = transformedPositions + "@" + result.str();
-		seq.data.assign(transformedData.begin(), transformedData.end());
 	}
+	return true;
 }
 
-void MSACompressor::reduceGapsC(Rectangle& rect) {
-	for (auto& seq : rect.sequences) {
-		std::ostringstream result;
-		std::ostringstream numbers;
-		char lastChar = '\0';
-		int dotCount = 0;
-		int symbolCount = 0;
-		if (seq.data[0] == '.') {
-			lastChar = '.';
-			dotCount = -1;
-		}
-		for (char ch : seq.data) {
-			if (ch != '.') {
-				if (lastChar != '\0') {
-					result << lastChar;
-					if (dotCount > 0) {
-						numbers << dotCount << ',';
-					}
-				}
-				lastChar = ch;
-				++symbolCount;
-				dotCount = 0;
-			}
-			else if (ch == '.') {
-				if (dotCount == 0) {
-					numbers << symbolCount << ',';
-					symbolCount = 0;
-				}
-				++dotCount;
-			}
+void MSACompressor::compressRectangle(Rectangle& rect, const ZstdParameters& parameters, PreprocessingType& preprocessingType, std::string* chain) {
+	static thread_local TileBuffer buffer;
+
+	const PreprocessingKernels* kernels = findPreprocessingKernels(preprocessingType);
+	if (kernels == NULL) {
+		std::cerr << "Compression error: Unknown preprocessing type: " << preprocessingType << std::endl;
+		return;
+	}
+
+	// a rectangle holding a single symbol, e.g. only gaps, is stored as that symbol and decoded with memset
+	rect.prefixed = false;
+	if (holdsSingleSymbol(rect)) {
+		rect.codec = FILL_CODEC;
+		rect.compressedData.assign(1, rect.rows[0][0]);
+		if (chain != NULL) {
+			chain->clear();
 		}
+		return;
+	}
 
-		if (lastChar != '\0') {
-			result << lastChar;
-			numbers << symbolCount << ',';
-			if (dotCount > 0) {
-				numbers << dotCount;
-			}
+	buffer.data.clear();
+	buffer.data.reserve(static_cast<size_t>(rect.width) * (rect.height + 1));
+	kernels->serialize(rect, buffer);
+	if (kernels->burrowsWheeler && !burrowsWheelerTransform(buffer.data)) {
+		// the rectangle is kept without the transform, its footer entry recording no preprocessing
+		preprocessingType = NO_PREPROCESSING;
+		kernels = findPreprocessingKernels(preprocessingType);
+		buffer.data.clear();
+		kernels->serialize(rect, buffer);
+	}
+	// a duplicate marked by submitBand keeps its reference, the next rectangle of its group being compressed against its rows
+	if (rect.codec == DUPLICATE_CODEC) {
+		if (chain != NULL) {
+			chain->swap(buffer.data);
+		}
+		return;
+	}
+	rect.codec = CONSTANT_CODEC;
+	size_t compressedSize = findTileCodec(CONSTANT_CODEC)->compress(NULL, buffer.data, rect.compressedData);
+	if (compressedSize == 0) {
+		rect.codec = ZSTD_CODEC;
+		bool chained = chain != NULL && !chain->empty();
+		rect.prefixed = chained;
+		// The producer relies on symbols staying in their columns, which only rows serialized without preprocessing keep,
+		// is given no dictionary or prefix content to match against, and is slower than the match finders of the fast levels
+		ZstdParameters rectParameters = parameters;
+		rectParameters.verticalMatches = parameters.verticalMatches && !parameters.literalsOnly && preprocessingType == NO_PREPROCESSING
+			&& !compressionDictionary && !chained && verticalMatchesPay(parameters.level);
+		ZSTD_CCtx* cctx = threadCompressionContext(rectParameters);
+		// referencing no dictionary returns the context to compression without one
+		ZSTD_CCtx_refCDict(cctx, compressionDictionary.get());
+		if (chained) {
+			// the prefix replaces the dictionary for this frame only
+			ZSTD_CCtx_refPrefix(cctx, chain->data(), chain->size());
+		}
+		if (rectParameters.verticalMatches) {
+			prepareVerticalMatches(buffer.data);
+		}
+		if (parameters.literalsOnly) {
+			compressedSize = compressLiterals(cctx, buffer.data, rect.compressedData);
+		}
+		else {
+			compressedSize = findTileCodec(rect.codec)->compress(cctx, buffer.data, rect.compressedData);
 		}
+	}
+	if (!ZSTD_isError(compressedSize) && compressedSize >= buffer.data.size()) {
+		rect.codec = STORED_CODEC;
+		compressedSize = findTileCodec(STORED_CODEC)->compress(NULL, buffer.data, rect.compressedData);
+	}
+	if (chain != NULL) {
+		chain->swap(buffer.data);
+	}
+	if (ZSTD_isError(compressedSize)) {
+		std::cerr << "Compression error: " << ZSTD_getErrorName(compressedSize) << std::endl;
+		return;
+	}
+}
+
+bool MSACompressor::burrowsWheelerTransform(std::string& rectData) {
+	if (rectData.size() > INT_MAX - sizeof(int32_t)) {
+		std::cerr << "Warning: Rectangle too large for the Burrows-Wheeler transform, reduce -a or -b. It is compressed without it." << std::endl;
+		return false;
+	}
+	int n = static_cast<int>(rectData.size());
+	std::vector<int> suffixArray(n);
+	std::string transformedData(sizeof(int32_t) + n, '\0');
+	unsigned char* bwt = reinterpret_cast<unsigned char*>(&transformedData[sizeof(int32_t)]);
+
+	int32_t primaryIndex = msac_divbwt(reinterpret_cast<const unsigned char*>(rectData.data()), bwt, suffixArray.data(), n, NULL, NULL, 0);
+	if (primaryIndex < 0) {
+		std::cerr << "Warning: Burrows-Wheeler transform failed, the rectangle is compressed without it." << std::endl;
+		return false;
+	}
+	std::memcpy(&transformedData[0], &primaryIndex, sizeof(primaryIndex));
 
-		std::string transformedPositions = numbers.str();
-		std::string transformedData = transformedPositions + "@" + result.str();
-		seq.data.assign(transformedData.begin(), transformedData.end());
+	unsigned char order[256];
+	for (int i = 0; i < 256; ++i) {
+		order[i] = static_cast<unsigned char>(i);
+	}
+	for (int i = 0; i < n; ++i) {
+		unsigned char symbol = bwt[i];
+		unsigned char rank = 0;
+		while (order[rank] != symbol) {
+			++rank;
+		}
+		std::memmove(order + 1, order, rank);
+		order[0] = symbol;
+		bwt[i] = rank;
 	}
+
+	rectData.swap(transformedData);
+	return true;
 }
 
-void MSACompressor::reverseGapsA(Rectangle& rect, const std::vector<std::string>& sequenceIds) {
-	std::vector<char> decompressedData(rect.width * rect.height * sizeof(char) * 2);
-	size_t decompressedSize = ZSTD_decompress(decompressedData.data(), decompressedData.size(), rect.compressedData.data(), rect.compressedData.size());
-	if (ZSTD_isError(decompressedSize)) {
-		std::cerr << "Decompression error: " << ZSTD_getErrorName(decompressedSize) << std::endl;
-		return;
+bool MSACompressor::reverseBurrowsWheelerTransform(const char* transformedData, size_t size, DecodeBuffer& rectData) {
+	int32_t primaryIndex = 0;
+	if (size > sizeof(int32_t) && size - sizeof(int32_t) <= INT_MAX) {
+		std::memcpy(&primaryIndex, transformedData, sizeof(primaryIndex));
+	}
+	int n = primaryIndex > 0 ? static_cast<int>(size - sizeof(int32_t)) : 0;
+	// the sentinel row lies after the first row and within the transformed data
+	if (primaryIndex <= 0 || primaryIndex > n) {
+		std::cerr << "Decompression error: Invalid primary index of the Burrows-Wheeler transform." << std::endl;
+		return false;
 	}
 
-	decompressedSize = decompressedData.size();
-	size_t dataIndex = 0;
+	std::vector<unsigned char> bwt(transformedData + sizeof(int32_t), transformedData + size);
+	unsigned char order[256];
+	for (int i = 0; i < 256; ++i) {
+		order[i] = static_cast<unsigned char>(i);
+	}
+	for (int i = 0; i < n; ++i) {
+		unsigned char rank = bwt[i];
+		unsigned char symbol = order[rank];
+		std::memmove(order + 1, order, rank);
+		order[0] = symbol;
+		bwt[i] = symbol;
+	}
 
-	for (int row = 0; row < rect.width; ++row) {
-		Sequence seq;
-		seq.id = sequenceIds[rect.startX + row];
+	// Rows of the sorted rotation matrix are counted with the implicit sentinel at primaryIndex,
+	// so bwt[i] belongs to row i before the sentinel and to row i + 1 after it.
+	int symbolStart[257] = { 0 };
+	for (int i = 0; i < n; ++i) {
+		++symbolStart[bwt[i] + 1];
+	}
+	for (int c = 0; c < 256; ++c) {
+		symbolStart[c + 1] += symbolStart[c];
+	}
+	std::vector<int> lastToFirst(n);
+	for (int i = 0; i < n; ++i) {
+		lastToFirst[i] = 1 + symbolStart[bwt[i]]++;
+	}
 
-		while (dataIndex < decompressedSize && decompressedData[dataIndex] != '#' && decompressedData[dataIndex] != '\0') {
-			char symbol = decompressedData[dataIndex++];
+	char* restored = resizeDecodeBuffer(rectData, n);
+	int row = 0;
+	for (int i = n - 1; i >= 0; --i) {
+		int index = row < primaryIndex ? row : row - 1;
+		restored[i] = static_cast<char>(bwt[index]);
+		row = lastToFirst[index];
+	}
+	return true;
+}
 
-			seq.data.push_back(symbol);
-			if (dataIndex < decompressedSize && std::isdigit(decompressedData[dataIndex])) {
-				int dotCount = 0;
-				while (dataIndex < decompressedSize && std::isdigit(decompressedData[dataIndex])) {
-					dotCount = dotCount * 10 + (decompressedData[dataIndex] - '0');
-					++dataIndex;
-				}
-				for (int i = 0; i < dotCount; ++i) {
-					seq.data.push_back('.');
-				}
+void MSACompressor::splitSequencesIntoRectangles(const std::vector<Sequence>& sequences, int startX, std::vector<Rectangle>& rectangles, int A, int B) {
+	int numRows = sequences.size();
+	if (numRows == 0) return;
+	int numCols = sequences[0].data.size();
+	for (int x = 0; x < numRows; x += A) {
+		for (int y = 0; y < numCols; y += B) {
+			Rectangle rect;
+			rect.startX = startX;
+			rect.startY = y;
+			rect.width = std::min(A, numRows - x);
+			rect.height = std::min(B, numCols - y);
+			rect.codec = ZSTD_CODEC;
+			rect.prefixed = false;
+			rect.rows.reserve(rect.width);
+			for (int i = 0; i < rect.width; ++i) {
+				rect.rows.push_back(sequences[x + i].data.data() + y);
 			}
+			rectangles.push_back(std::move(rect));
 		}
+	}
+}
 
-		if (dataIndex < decompressedSize && decompressedData[dataIndex] == '#') {
-			++dataIndex;
+PreprocessingType MSACompressor::choosePreprocessing(const Rectangle& rect, const ZstdParameters& parameters, ThreadPool* pool) {
+	static const PreprocessingType candidates[] = { NO_PREPROCESSING, REDUCE_GAPS_A, REDUCE_GAPS_B, REDUCE_GAPS_C, BWT_MTF, BWT_MTF_BY_COLUMN };
+
+	Rectangle sample;
+	sample.startX = rect.startX;
+	sample.startY = rect.startY;
+	sample.height = rect.height;
+	sample.codec = ZSTD_CODEC;
+	sample.prefixed = false;
+	if (rect.width <= AUTO_SAMPLE_BLOCKS * AUTO_SAMPLE_BLOCK_ROWS) {
+		sample.rows = rect.rows;
+	}
+	else {
+		for (int block = 0; block < AUTO_SAMPLE_BLOCKS; ++block) {
+			int firstRow = static_cast<int>(static_cast<int64_t>(rect.width - AUTO_SAMPLE_BLOCK_ROWS) * block / (AUTO_SAMPLE_BLOCKS - 1));
+			sample.rows.insert(sample.rows.end(), rect.rows.begin() + firstRow, rect.rows.begin() + firstRow + AUTO_SAMPLE_BLOCK_ROWS);
+		}
+	}
+	sample.width = static_cast<int>(sample.rows.size());
+
+	std::vector<std::future<size_t>> trialSizes;
+	for (PreprocessingType candidate : candidates) {
+		auto compressTrial = [this, &sample, &parameters, candidate]() {
+			Rectangle trial = sample;
+			PreprocessingType trialType = candidate;
+			compressRectangle(trial, parameters, trialType);
+			return trial.compressedData.size();
+		};
+		if (pool != NULL) {
+			trialSizes.push_back(pool->submit(compressTrial));
+		}
+		else {
+			std::packaged_task<size_t()> trialTask(compressTrial);
+			trialSizes.push_back(trialTask.get_future());
+			trialTask();
 		}
+	}
 
-		rect.sequences.push_back(seq);
+	PreprocessingType bestType = candidates[0];
+	size_t bestSize = SIZE_MAX;
+	for (size_t i = 0; i < trialSizes.size(); ++i) {
+		size_t trialSize = trialSizes[i].get();
+		if (trialSize < bestSize) {
+			bestSize = trialSize;
+			bestType = candidates[i];
+		}
 	}
+	return bestType;
 }
 
-void MSACompressor::reverseGapsB(Rectangle& rect, const std::vector<std::string>& sequenceIds) {
-	std::vector<char> decompressedData(rect.width * rect.height * sizeof(char) * 2);
-	size_t decompressedSize = ZSTD_decompress(decompressedData.data(), decompressedData.size(), rect.compressedData.data(), rect.compressedData.size());
-	if (ZSTD_isError(decompressedSize)) {
-		std::cerr << "Decompression error: " << ZSTD_getErrorName(decompressedSize) << std::endl;
-		return;
-	}
+static ZstdParameters zstdParameters(const CompressionOptions& options) {
+	ZstdParameters parameters = { options.zstdLevel, options.windowLog, options.strategy, options.longDistanceMatching, options.verticalMatches, options.literalsOnly };
+	return parameters;
+}
 
-	size_t dataIndex = 0;
+static void writeParameters(std::ofstream& ofs, const ZstdParameters& parameters) {
+	int32_t level = parameters.level;
+	int32_t windowLog = parameters.windowLog;
+	int32_t strategy = parameters.strategy;
+	uint32_t flags = (parameters.longDistanceMatching ? PARAMETER_LONG_DISTANCE_MATCHING : 0) | (parameters.verticalMatches ? PARAMETER_VERTICAL_MATCHES : 0);
+	ofs.write(reinterpret_cast<const char*>(&level), sizeof(level));
+	ofs.write(reinterpret_cast<const char*>(&windowLog), sizeof(windowLog));
+	ofs.write(reinterpret_cast<const char*>(&strategy), sizeof(strategy));
+	ofs.write(reinterpret_cast<const char*>(&flags), sizeof(flags));
+}
 
-	for (int row = 0; row < rect.width; ++row) {
-		Sequence seq;
-		seq.id = sequenceIds[rect.startX + row];
+static void readParameters(std::ifstream& ifs, ZstdParameters& parameters) {
+	int32_t level = 0;
+	int32_t windowLog = 0;
+	int32_t strategy = 0;
+	uint32_t flags = 0;
+	ifs.read(reinterpret_cast<char*>(&level), sizeof(level));
+	ifs.read(reinterpret_cast<char*>(&windowLog), sizeof(windowLog));
+	ifs.read(reinterpret_cast<char*>(&strategy), sizeof(strategy));
+	ifs.read(reinterpret_cast<char*>(&flags), sizeof(flags));
+	parameters.level = level;
+	parameters.windowLog = windowLog;
+	parameters.strategy = strategy;
+	parameters.longDistanceMatching = (flags & PARAMETER_LONG_DISTANCE_MATCHING) != 0;
+	parameters.verticalMatches = (flags & PARAMETER_VERTICAL_MATCHES) != 0;
+}
 
-		std::string posString;
-		while (dataIndex < decompressedSize && decompressedData[dataIndex] != '@') {
-			posString.push_back(decompressedData[dataIndex++]);
-		}
-		++dataIndex;
-
-		std::istringstream posStream(posString);
-		std::vector<int> dotPositions;
-		std::vector<int> dotNumbers;
-		std::string token;
-		while (std::getline(posStream, token, ',')) {
-			dotPositions.push_back(std::stoi(token));
-			std::getline(posStream, token, ',');
-			dotNumbers.push_back(std::stoi(token));
-		}
-		dotPositions.push_back(decompressedSize);
-
-		int posIndex = 0;
-		int seqIndex = 0;
-		int counter = 0;
-		while (dataIndex < decompressedSize && decompressedData[dataIndex] != '#' && decompressedData[dataIndex] != '\0') {
-			posIndex = dotPositions[counter];
-			if (seqIndex < posIndex) {
-				seq.data.push_back(decompressedData[dataIndex]);
-				++dataIndex;
-				++seqIndex;
-			}
-			else {
-				for (int i = 0; i < dotNumbers[counter]; i++) {
-					seq.data.push_back('.');
-					++seqIndex;
-				}
-				++counter;
-			}
+/**
+ * Reads the header lines of an alignment, leaving the first line that follows them in line.
+ */
+static void readHeaders(std::istream& is, std::vector<std::string>& headers, std::string& line) {
+	while (std::getline(is, line)) {
+		if (line.empty() || line[0] == '/') {
+			continue;
 		}
-
-		if (dataIndex < decompressedSize && decompressedData[dataIndex] == '#') {
-			++dataIndex;
+		if (line[0] == '#') {
+			headers.push_back(line);
+			continue;
 		}
+		break;
+	}
+}
 
-		rect.sequences.push_back(seq);
+static void parseSequence(const std::string& line, Sequence& seq) {
+	std::istringstream iss(line);
+	std::string data;
+	iss >> seq.id >> data;
+	seq.data.assign(data.begin(), data.end());
+}
+
+/**
+ * Returns the kernels producing dictionary samples for the given preprocessing. The transforms applied
+ * to whole rectangles and the per-rectangle choice cannot be anticipated, so rows are then sampled as they are.
+ */
+static const PreprocessingKernels* dictionarySampleKernels(PreprocessingType preprocessingType) {
+	if (preprocessingType == AUTO_PREPROCESSING || preprocessingType == BWT_MTF || preprocessingType == BWT_MTF_BY_COLUMN) {
+		preprocessingType = NO_PREPROCESSING;
 	}
+	return findPreprocessingKernels(preprocessingType);
 }
 
-void MSACompressor::reverseGapsC(Rectangle& rect, const std::vector<std::string>& sequenceIds) {
-	std::vector<char> decompressedData(rect.width * rect.height * sizeof(char) * 2);
-	size_t decompressedSize = ZSTD_decompress(decompressedData.data(), decompressedData.size(), rect.compressedData.data(), rect.compressedData.size());
-	if (ZSTD_isError(decompressedSize)) {
-		std::cerr << "Decompression error: " << ZSTD_getErrorName(decompressedSize) << std::endl;
-		return;
+/**
+ * Appends the serialized rows of a rectangle to the samples, one sample per row.
+ */
+static void appendDictionarySamples(const Rectangle& rect, const PreprocessingKernels* kernels, TileBuffer& buffer, std::string& samples, std::vector<size_t>& sampleSizes) {
+	buffer.data.clear();
+	kernels->serialize(rect, buffer);
+	size_t rowStart = 0;
+	for (size_t i = 0; i < buffer.data.size(); ++i) {
+		if (buffer.data[i] == '#') {
+			sampleSizes.push_back(i + 1 - rowStart);
+			rowStart = i + 1;
+		}
 	}
+	samples += buffer.data;
+}
 
-	size_t dataIndex = 0;
+/**
+ * Trains a dictionary of at most dictionarySize bytes on the samples. Returns the ZDICT result, an error code if training fails.
+ */
+static size_t trainDictionaryOnSamples(const std::string& samples, const std::vector<size_t>& sampleSizes, size_t dictionarySize, std::vector<char>& dictionary) {
+	dictionary.resize(dictionarySize);
+	size_t result = ZDICT_trainFromBuffer(dictionary.data(), dictionary.size(), samples.data(), sampleSizes.data(), static_cast<unsigned>(sampleSizes.size()));
+	dictionary.resize(ZDICT_isError(result) ? 0 : result);
+	return result;
+}
 
-	for (int row = 0; row < rect.width; ++row) {
-		Sequence seq;
-		seq.id = sequenceIds[rect.startX + row];
+void MSACompressor::queueBand(std::vector<Sequence>& sequences, int startX, const CompressionOptions& options, std::deque<CompressionBand>& pendingBands) {
+	pendingBands.emplace_back();
+	CompressionBand& band = pendingBands.back();
+	band.sequences.swap(sequences);
+	splitSequencesIntoRectangles(band.sequences, startX, band.rectangles, options.A, options.B);
+}
 
-		std::string posString;
-		while (dataIndex < decompressedSize && decompressedData[dataIndex] != '@') {
-			posString.push_back(decompressedData[dataIndex++]);
+/**
+ * Hash of the cells of a rectangle being compressed, read a word at a time, finding the rectangles it may repeat.
+ */
+static uint64_t cellsHash(const Rectangle& rect) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (const char* row : rect.rows) {
+		int column = 0;
+		for (; column + static_cast<int>(sizeof(uint64_t)) <= rect.height; column += sizeof(uint64_t)) {
+			uint64_t word;
+			std::memcpy(&word, row + column, sizeof(word));
+			hash = (hash ^ word) * 1099511628211ULL;
+			hash ^= hash >> 29;
 		}
-		++dataIndex;
+		for (; column < rect.height; ++column) {
+			hash = (hash ^ static_cast<unsigned char>(row[column])) * 1099511628211ULL;
+		}
+	}
+	return hash;
+}
 
-		std::istringstream posStream(posString);
-		std::vector<int> numbers;
-		std::string token;
-		while (std::getline(posStream, token, ',')) {
-			numbers.push_back(std::stoi(token));
+/**
+ * Returns whether a rectangle being compressed has the dimensions and cells of a candidate.
+ */
+static bool hasSameCells(const PayloadCandidate& candidate, const Rectangle& rect) {
+	if (candidate.width != rect.width || candidate.height != rect.height) {
+		return false;
+	}
+	const char* cells = candidate.cells.data();
+	for (const char* row : rect.rows) {
+		if (std::memcmp(cells, row, rect.height) != 0) {
+			return false;
 		}
+		cells += rect.height;
+	}
+	return true;
+}
 
-		int posIndex = 0;
-		int seqIndex = 0;
-		int counter = 0;
-		int flag = 0;
-		while (dataIndex < decompressedSize && decompressedData[dataIndex] != '#' && decompressedData[dataIndex] != '\0') {
-			if (flag == 0) {
-				for (int i = 0; i < numbers[counter]; i++) {
-					seq.data.push_back(decompressedData[dataIndex]);
-					dataIndex++;
-				}
-				flag = 1;
-				counter++;
-			}
-			else {
-				for (int i = 0; i < numbers[counter]; i++) {
-					seq.data.push_back('.');
-				}
-				flag = 0;
-				counter++;
+/**
+ * Marks a rectangle repeating the cells of a candidate as its duplicate, holding the index of the candidate.
+ * Otherwise keeps its cells as a new candidate while the budget allows. Returns whether it is a duplicate.
+ * Filled rectangles are smaller than a reference and are left to the compressor.
+ */
+static bool markDuplicate(Rectangle& rect, size_t index, PayloadIndex& payloads) {
+	if (index >= UINT32_MAX || rect.width == 0 || rect.height == 0 || holdsSingleSymbol(rect)) {
+		return false;
+	}
+	size_t cellCount = static_cast<size_t>(rect.width) * rect.height;
+	bool keepCandidate = payloads.candidateBytes + cellCount <= DUPLICATE_CANDIDATE_BYTES;
+	if (!keepCandidate && payloads.entries.empty()) {
+		return false;
+	}
+	uint64_t hash = cellsHash(rect);
+	auto found = payloads.entries.find(hash);
+	if (found != payloads.entries.end()) {
+		for (const PayloadCandidate& candidate : found->second) {
+			if (hasSameCells(candidate, rect)) {
+				rect.codec = DUPLICATE_CODEC;
+				rect.compressedData.resize(sizeof(candidate.index));
+				std::memcpy(rect.compressedData.data(), &candidate.index, sizeof(candidate.index));
+				return true;
 			}
 		}
-
-		if (dataIndex < decompressedSize && decompressedData[dataIndex] == '#') {
-			++dataIndex;
+	}
+	if (keepCandidate) {
+		PayloadCandidate candidate;
+		candidate.index = static_cast<uint32_t>(index);
+		candidate.width = rect.width;
+		candidate.height = rect.height;
+		candidate.cells.reserve(cellCount);
+		for (const char* row : rect.rows) {
+			candidate.cells.insert(candidate.cells.end(), row, row + rect.height);
 		}
-
-		rect.sequences.push_back(seq);
+		payloads.entries[hash].push_back(std::move(candidate));
+		payloads.candidateBytes += cellCount;
 	}
+	return false;
 }
 
-void MSACompressor::reduceGapsAndUpperCase(Rectangle& rect) {
-	for (auto& seq : rect.sequences) {
-		std::ostringstream result;
-		char lastChar = '\0';
-		int dotCount = 0;
-		if (seq.data[0] == '.') {
-			lastChar = '.';
-			dotCount = -1;
+void MSACompressor::submitBand(CompressionBand& band, const CompressionOptions& options, ThreadPool& pool, PayloadIndex& payloads) {
+	// With parallel rectangles the automatic choice runs its trials inline, as waiting for them
+	// from a worker could leave the pool with no thread free to run them.
+	bool parallelRectangles = options.threads > 1;
+	ThreadPool* trialPool = parallelRectangles ? NULL : &pool;
+	ZstdParameters parameters = zstdParameters(options);
+	PreprocessingType preprocessingType = options.preprocessingType;
+	size_t groupSize = static_cast<size_t>(std::max(options.tileGroupSize, 1));
+	band.types.assign(band.rectangles.size(), preprocessingType);
+	for (size_t groupStart = 0; groupStart < band.rectangles.size(); groupStart += groupSize) {
+		Rectangle* rectPtr = &band.rectangles[groupStart];
+		PreprocessingType* typePtr = &band.types[groupStart];
+		size_t count = std::min(groupSize, band.rectangles.size() - groupStart);
+		// Identical cells give the same preprocessing and frame, and the first rectangle of a group is compressed on its
+		// own. A duplicate followed by more rectangles of its group is still serialized for them to be compressed against.
+		if (markDuplicate(*rectPtr, payloads.submitted + groupStart, payloads) && count == 1) {
+			continue;
 		}
-		for (char ch : seq.data) {
-			ch = std::toupper(ch);
-			if (ch != '.') {
-				if (lastChar != '\0') {
-					result << lastChar;
-					if (dotCount > 0) {
-						result << dotCount;
-					}
+		auto compressTask = [this, rectPtr, typePtr, count, parameters, preprocessingType, trialPool]() {
+			std::string chain;
+			for (size_t i = 0; i < count; ++i) {
+				if (preprocessingType == AUTO_PREPROCESSING) {
+					typePtr[i] = choosePreprocessing(rectPtr[i], parameters, trialPool);
 				}
-				lastChar = ch;
-				dotCount = 0;
-			}
-			else if (ch == '.') {
-				++dotCount;
+				compressRectangle(rectPtr[i], parameters, typePtr[i], count > 1 ? &chain : NULL);
 			}
+		};
+		if (parallelRectangles) {
+			band.results.push_back(pool.submit(compressTask));
 		}
-		if (lastChar != '\0') {
-			result << lastChar;
-			if (dotCount > 0) {
-				result << dotCount;
-			}
+		else {
+			std::packaged_task<void()> task(compressTask);
+			band.results.push_back(task.get_future());
+			task();
 		}
-		std::string transformedData = result.str();
-		seq.data.assign(transformedData.begin(), transformedData.end());
 	}
+	payloads.submitted += band.rectangles.size();
 }
 
-void MSACompressor::reduceGapsAndLowerCase(Rectangle& rect) {
-	for (auto& seq : rect.sequences) {
-		std::ostringstream result;
-		char lastChar = '\0';
-		int dotCount = 0;
-		if (seq.data[0] == '.') {
-			lastChar = '.';
-			dotCount = -1;
-		}
-		for (char ch : seq.data) {
-			ch = std::tolower(ch);
-			if (ch != '.') {
-				if (lastChar != '\0') {
-					result << lastChar;
-					if (dotCount > 0) {
-						result << dotCount;
-					}
-				}
-				lastChar = ch;
-				dotCount = 0;
-			}
-			else if (ch == '.') {
-				++dotCount;
-			}
-		}
-		if (lastChar != '\0') {
-			result << lastChar;
-			if (dotCount > 0) {
-				result << dotCount;
+bool MSACompressor::trainDictionary(const std::deque<CompressionBand>& bands, const CompressionOptions& options, std::vector<char>& dictionary) {
+	const PreprocessingKernels* kernels = dictionarySampleKernels(options.preprocessingType);
+	size_t sampleLimit = options.dictionarySize * DICTIONARY_SAMPLE_RATIO;
+
+	TileBuffer buffer;
+	std::string samples;
+	std::vector<size_t> sampleSizes;
+	for (const auto& band : bands) {
+		for (const auto& rect : band.rectangles) {
+			if (samples.size() >= sampleLimit) {
+				break;
 			}
+			appendDictionarySamples(rect, kernels, buffer, samples, sampleSizes);
 		}
-		std::string transformedData = result.str();
-		seq.data.assign(transformedData.begin(), transformedData.end());
 	}
+
+	size_t result = trainDictionaryOnSamples(samples, sampleSizes, options.dictionarySize, dictionary);
+	if (ZDICT_isError(result)) {
+		std::cerr << "Warning: Unable to train a dictionary (" << ZDICT_getErrorName(result) << "), compressing without it." << std::endl;
+		return false;
+	}
+
+	compressionDictionary.reset(ZSTD_createCDict(dictionary.data(), dictionary.size(), options.zstdLevel));
+	if (!compressionDictionary) {
+		std::cerr << "Error: Unable to create a compression dictionary." << std::endl;
+		exit(1);
+	}
+	return true;
 }
 
-void MSACompressor::decompressRectangle(Rectangle& rect, const std::vector<std::string>& sequenceIds) {
-	std::vector<char> decompressedData(rect.width * rect.height * sizeof(char) * 2);
-	size_t decompressedSize = ZSTD_decompress(decompressedData.data(), decompressedData.size(), rect.compressedData.data(), rect.compressedData.size());
-	if (ZSTD_isError(decompressedSize)) {
-		std::cerr << "Decompression error: " << ZSTD_getErrorName(decompressedSize) << std::endl;
-		return;
+void MSACompressor::writeBand(CompressionBand& band, std::ofstream& ofs, std::vector<std::string>& uniqueIds, std::vector<FooterEntry>& footer) {
+	for (auto& result : band.results) {
+		result.get();
 	}
+	for (size_t i = 0; i < band.rectangles.size(); ++i) {
+		Rectangle& rect = band.rectangles[i];
+		uint64_t offset = ofs.tellp();
+		FooterEntry entry = { rect.startX, rect.startY, rect.width, rect.height, rect.compressedData.size(), band.types[i], rect.codec, rect.prefixed, offset };
+
+		if (rect.codec == DUPLICATE_CODEC) {
+			// the automatic choice only ran for the rectangle repeated
+			uint32_t original;
+			std::memcpy(&original, rect.compressedData.data(), sizeof(original));
+			entry.preprocessingType = footer[original].preprocessingType;
+		}
 
-	decompressedSize = decompressedData.size();
-	size_t dataIndex = 0;
+		ofs.write(rect.compressedData.data(), rect.compressedData.size());
+		footer.push_back(entry);
+		std::vector<char>().swap(rect.compressedData);
+	}
+	for (const auto& seq : band.sequences) {
+		uniqueIds.push_back(seq.id);
+	}
+}
 
-	for (int row = 0; row < rect.width; ++row) {
-		Sequence seq;
-		seq.id = sequenceIds[rect.startX + row];
+void MSACompressor::readFooter(std::ifstream& ifs, uint64_t& dataStartPos, uint64_t& sequenceIdsStartPos, uint64_t& footerStartPos, std::vector<FooterEntry>& footer, PreprocessingType preprocessingType) {
+	ifs.seekg(0, std::ios::end);
+	uint64_t fileSize = ifs.tellg();
+	uint64_t trailerSize = 3 * sizeof(uint64_t);
+	uint64_t entrySize = 4 * sizeof(int) + sizeof(uint64_t);
+
+	uint32_t version = 0;
+	uint32_t magic = 0;
+	if (fileSize >= trailerSize + sizeof(version) + sizeof(magic)) {
+		ifs.seekg(-static_cast<int>(sizeof(version) + sizeof(magic)), std::ios::end);
+		ifs.read(reinterpret_cast<char*>(&version), sizeof(version));
+		ifs.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+	}
+	bool versioned = magic == ARCHIVE_MAGIC;
+	if (versioned) {
+		if (version != ARCHIVE_VERSION) {
+			std::cerr << "Error: Unsupported compressed file version: " << version << std::endl;
+			exit(1);
+		}
+		trailerSize += sizeof(uint64_t) + sizeof(uint32_t) + PARAMETERS_SIZE + sizeof(uint32_t) + sizeof(version) + sizeof(magic);
+		entrySize += 2 * sizeof(uint8_t);
+	}
+	if (fileSize < trailerSize) {
+		std::cerr << "Error: Unable to read the footer of the compressed file." << std::endl;
+		exit(1);
+	}
 
-		while (dataIndex < decompressedSize && decompressedData[dataIndex] != '#' && decompressedData[dataIndex] != '\0') {
-			char symbol = decompressedData[dataIndex++];
+	ifs.seekg(fileSize - trailerSize, std::ios::beg);
+	ifs.read(reinterpret_cast<char*>(&dataStartPos), sizeof(dataStartPos));
+	ifs.read(reinterpret_cast<char*>(&sequenceIdsStartPos), sizeof(sequenceIdsStartPos));
+	ifs.read(reinterpret_cast<char*>(&footerStartPos), sizeof(footerStartPos));
 
-			seq.data.push_back(symbol);
+	uint64_t dictionaryStartPos = sequenceIdsStartPos;
+	uint32_t libraryDictionaryId = 0;
+	uint32_t tileGroupSize = 1;
+	archiveParameters = ZstdParameters();
+	if (versioned) {
+		ifs.read(reinterpret_cast<char*>(&dictionaryStartPos), sizeof(dictionaryStartPos));
+		ifs.read(reinterpret_cast<char*>(&libraryDictionaryId), sizeof(libraryDictionaryId));
+		readParameters(ifs, archiveParameters);
+		ifs.read(reinterpret_cast<char*>(&tileGroupSize), sizeof(tileGroupSize));
+	}
+	// positions past the footer would make the entry count below wrap around
+	if (!ifs || dataStartPos > sequenceIdsStartPos || sequenceIdsStartPos > footerStartPos || footerStartPos > fileSize - trailerSize) {
+		std::cerr << "Error: Unable to read the footer of the compressed file." << std::endl;
+		exit(1);
+	}
+	archiveTileGroupSize = static_cast<int>(std::min<uint32_t>(std::max<uint32_t>(tileGroupSize, 1), INT_MAX));
+
+	embeddedDictionary.reset();
+	decompressionDictionary = NULL;
+	if (ifs && libraryDictionaryId != 0) {
+		if (dictionaryLibraryFile.empty()) {
+			std::cerr << "Error: The file was compressed with dictionary " << libraryDictionaryId << " of a library, which must be given with -L." << std::endl;
+			exit(1);
+		}
+		decompressionDictionary = sharedDecompressionDictionary(dictionaryLibraryFile, libraryDictionaryId);
+		if (decompressionDictionary == NULL) {
+			std::cerr << "Error: Dictionary " << libraryDictionaryId << " not found in library: " << dictionaryLibraryFile << std::endl;
+			exit(1);
+		}
+	}
+	else if (ifs && dictionaryStartPos < sequenceIdsStartPos) {
+		std::vector<char> dictionary(sequenceIdsStartPos - dictionaryStartPos);
+		ifs.seekg(dictionaryStartPos, std::ios::beg);
+		ifs.read(dictionary.data(), dictionary.size());
+		embeddedDictionary.reset(ZSTD_createDDict(dictionary.data(), dictionary.size()));
+		if (!ifs || !embeddedDictionary) {
+			std::cerr << "Error: Unable to read the dictionary of the compressed file." << std::endl;
+			exit(1);
 		}
+		decompressionDictionary = embeddedDictionary.get();
+	}
 
-		if (dataIndex < decompressedSize && decompressedData[dataIndex] == '#') {
-			++dataIndex;
+	ifs.seekg(footerStartPos, std::ios::beg);
+	uint64_t entryCount = (fileSize - trailerSize - footerStartPos) / entrySize;
+	footer.reserve(entryCount);
+	int bandPosition = 0;
+	uint64_t offset = dataStartPos;
+	for (uint64_t i = 0; i < entryCount; ++i) {
+		FooterEntry entry;
+		ifs.read(reinterpret_cast<char*>(&entry.startX), sizeof(entry.startX));
+		ifs.read(reinterpret_cast<char*>(&entry.startY), sizeof(entry.startY));
+		ifs.read(reinterpret_cast<char*>(&entry.width), sizeof(entry.width));
+		ifs.read(reinterpret_cast<char*>(&entry.height), sizeof(entry.height));
+		ifs.read(reinterpret_cast<char*>(&entry.compressedSize), sizeof(entry.compressedSize));
+		entry.preprocessingType = preprocessingType;
+		entry.codec = ZSTD_CODEC;
+		if (versioned) {
+			uint8_t type;
+			ifs.read(reinterpret_cast<char*>(&type), sizeof(type));
+			entry.preprocessingType = static_cast<PreprocessingType>(type);
+			uint8_t codec;
+			ifs.read(reinterpret_cast<char*>(&codec), sizeof(codec));
+			entry.codec = static_cast<TileCodec>(codec);
 		}
+		// rectangles of a band are stored in column order, its tile groups starting every archiveTileGroupSize of them
+		bandPosition = !footer.empty() && footer.back().startX == entry.startX ? bandPosition + 1 : 0;
+		entry.chained = bandPosition % archiveTileGroupSize != 0;
+		entry.offset = offset;
+		offset += entry.compressedSize;
+		footer.push_back(entry);
+	}
 
-		rect.sequences.push_back(seq);
+	if (!ifs) {
+		std::cerr << "Error: Unable to read the footer of the compressed file." << std::endl;
+		exit(1);
 	}
 }
 
-void MSACompressor::decompressRectangleByColumn(Rectangle& rect, const std::vector<std::string>& sequenceIds) {
-	std::vector<char> decompressedData(rect.width * rect.height * sizeof(char) * 2);
-	size_t decompressedSize = ZSTD_decompress(decompressedData.data(), decompressedData.size(), rect.compressedData.data(), rect.compressedData.size());
-	if (ZSTD_isError(decompressedSize)) {
-		std::cerr << "Decompression error: " << ZSTD_getErrorName(decompressedSize) << std::endl;
-		return;
+MSACompressor::MSACompressor() : decompressionDictionary(NULL), archiveParameters(), archiveTileGroupSize(1) {
+
+}
+
+void MSACompressor::setDictionaryLibrary(const std::string& libraryFile) {
+	dictionaryLibraryFile = libraryFile;
+}
+
+void MSACompressor::buildDictionaryLibrary(const std::string& libraryFile, const std::vector<std::string>& inputFiles, const CompressionOptions& options) {
+	std::map<std::string, std::vector<std::string>> clanFamilies;
+	for (const auto& inputFile : inputFiles) {
+		std::ifstream ifs(inputFile);
+		if (!ifs) {
+			std::cerr << "Error: Unable to open input file: " << inputFile << std::endl;
+			exit(1);
+		}
+		std::vector<std::string> headers;
+		std::string line;
+		readHeaders(ifs, headers, line);
+		clanFamilies[findClan(headers)].push_back(inputFile);
 	}
 
-	decompressedSize = decompressedData.size();
-	size_t dataIndex = 0;
-	std::vector <Sequence> sequences;
-	Sequence seq;
+	size_t dictionarySize = options.dictionarySize > 0 ? options.dictionarySize : DEFAULT_LIBRARY_DICTIONARY_SIZE;
+	const PreprocessingKernels* kernels = dictionarySampleKernels(options.preprocessingType);
+	DictionaryLibrary library;
+	TileBuffer buffer;
+	for (const auto& clan : clanFamilies) {
+		// every family of the clan contributes the same share of samples
+		size_t familySampleLimit = dictionarySize * DICTIONARY_SAMPLE_RATIO / clan.second.size();
+		std::string samples;
+		std::vector<size_t> sampleSizes;
+		for (const auto& inputFile : clan.second) {
+			std::ifstream ifs(inputFile);
+			std::vector<std::string> headers;
+			std::vector<Sequence> sequences;
+			std::string line;
+			readHeaders(ifs, headers, line);
+			size_t familySamples = 0;
+			do {
+				if (line.empty() || line[0] == '/')
+					break;
+				Sequence seq;
+				parseSequence(line, seq);
+				familySamples += seq.data.size();
+				sequences.push_back(std::move(seq));
+			} while (familySamples < familySampleLimit && std::getline(ifs, line));
+
+			std::vector<Rectangle> familyRectangles;
+			splitSequencesIntoRectangles(sequences, 0, familyRectangles, options.A, options.B);
+			for (const auto& rect : familyRectangles) {
+				appendDictionarySamples(rect, kernels, buffer, samples, sampleSizes);
+			}
+		}
 
-	for (int row = 0; row < rect.width; ++row) {
-		seq.id = sequenceIds[rect.startX + row];
-		sequences.push_back(seq);
+		std::string clanName = clan.first.empty() ? "families without a clan" : "clan " + clan.first;
+		std::vector<char> dictionary;
+		size_t result = trainDictionaryOnSamples(samples, sampleSizes, dictionarySize, dictionary);
+		if (ZDICT_isError(result)) {
+			std::cerr << "Warning: Unable to train a dictionary for " << clanName << " (" << ZDICT_getErrorName(result) << "), skipping it." << std::endl;
+		}
+		else if (!library.add(clan.first, dictionary)) {
+			std::cerr << "Warning: The dictionary for " << clanName << " has no dictionary ID, skipping it." << std::endl;
+		}
 	}
 
-	for (int column = 0; column < rect.height; ++column) {
-		for (int row = 0; row < rect.width; ++row) {
-			if (dataIndex < decompressedSize && decompressedData[dataIndex] != '#' && decompressedData[dataIndex] != '\0') {
-				char symbol = decompressedData[dataIndex++];
-				sequences[row].data.push_back(symbol);
+	if (!library.save(libraryFile)) {
+		std::cerr << "Error: Unable to write dictionary library: " << libraryFile << std::endl;
+		exit(1);
+	}
+}
+
+TuningResult MSACompressor::measureConfiguration(const std::vector<Sequence>& sample, const CompressionOptions& options) {
+	typedef std::chrono::steady_clock Clock;
+	ZstdParameters parameters = zstdParameters(options);
+	int columns = static_cast<int>(sample[0].data.size());
+	size_t groupSize = static_cast<size_t>(std::max(options.tileGroupSize, 1));
+
+	TuningResult result;
+	result.options = options;
+	result.compressedSize = 0;
+	double compressionSeconds = 0;
+	double decompressionSeconds = 0;
+	int measuredBands = 0;
+	int bandCount = (static_cast<int>(sample.size()) + options.A - 1) / options.A;
+	int latencyBandStep = std::max(1, bandCount / TUNE_LATENCY_BANDS);
+	std::vector<std::string> sequenceIds;
+	for (const auto& seq : sample) {
+		sequenceIds.push_back(seq.id);
+	}
+	// the rectangles are decoded as an archive written with this configuration is
+	archiveParameters = parameters;
+	archiveTileGroupSize = static_cast<int>(groupSize);
+	for (int band = 0; band < bandCount; ++band) {
+		int startX = band * options.A;
+		std::vector<Sequence> sequences(sample.begin() + startX, sample.begin() + std::min<size_t>(sample.size(), startX + options.A));
+		std::vector<Rectangle> rectangles;
+		std::vector<PreprocessingType> types;
+		splitSequencesIntoRectangles(sequences, startX, rectangles, options.A, options.B);
+
+		Clock::time_point start = Clock::now();
+		std::string chain;
+		for (size_t i = 0; i < rectangles.size(); ++i) {
+			Rectangle& rect = rectangles[i];
+			PreprocessingType rectPreprocessingType = options.preprocessingType;
+			if (rectPreprocessingType == AUTO_PREPROCESSING) {
+				rectPreprocessingType = choosePreprocessing(rect, parameters, NULL);
+			}
+			if (i % groupSize == 0) {
+				chain.clear();
 			}
+			compressRectangle(rect, parameters, rectPreprocessingType, groupSize > 1 ? &chain : NULL);
+			types.push_back(rectPreprocessingType);
+			result.compressedSize += rect.compressedData.size() + TUNE_FOOTER_ENTRY_SIZE;
 		}
-		if (dataIndex < decompressedSize && decompressedData[dataIndex] == '#') {
-			++dataIndex;
+		compressionSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+		// Ds decodes the rectangles of the band holding a sequence up to its row, as decodeChosenRectangles does,
+		// the middle row of the band standing for a sequence chosen at random
+		if (band % latencyBandStep == 0) {
+			int rowCount = static_cast<int>(sequences.size()) / 2 + 1;
+			std::vector<Rectangle> decoded(rectangles.size());
+			for (size_t i = 0; i < rectangles.size(); ++i) {
+				decoded[i].startX = rectangles[i].startX;
+				decoded[i].startY = rectangles[i].startY;
+				decoded[i].width = rectangles[i].width;
+				decoded[i].height = rectangles[i].height;
+				decoded[i].codec = rectangles[i].codec;
+				decoded[i].prefixed = rectangles[i].prefixed;
+				decoded[i].compressedData.swap(rectangles[i].compressedData);
+			}
+			start = Clock::now();
+			std::vector<char> decodedChain;
+			std::vector<char>* rectChain = groupSize > 1 ? &decodedChain : NULL;
+			for (size_t i = 0; i < decoded.size(); ++i) {
+				if (i % groupSize == 0) {
+					decodedChain.clear();
+				}
+				// the next rectangle of a tile group is decoded against the whole frame of this one
+				if (groupSize > 1 && (i + 1) % groupSize != 0 && i + 1 < decoded.size()) {
+					reversePreprocessing(decoded[i], types[i], sequenceIds, rectChain);
+				}
+				else {
+					reverseLeadingRows(decoded[i], types[i], rowCount, sequenceIds, rectChain);
+				}
+			}
+			decompressionSeconds += std::chrono::duration<double>(Clock::now() - start).count();
+			++measuredBands;
 		}
+	}
 
+	uint64_t inputSize = static_cast<uint64_t>(sample.size()) * columns;
+	uint64_t bandSize = static_cast<uint64_t>(std::min<size_t>(sample.size(), options.A)) * columns;
+	uint64_t rectangleSize = static_cast<uint64_t>(std::min<size_t>(sample.size(), options.A)) * (std::min(columns, options.B) + 1);
+	size_t compressionContextSize = ZSTD_estimateCCtxSize_usingCParams(ZSTD_getCParams(options.zstdLevel, rectangleSize, 0));
+	double compressionMemory = bandSize + options.threads * (2.0 * rectangleSize + compressionContextSize);
+	double decompressionMemory = bandSize + 2.0 * rectangleSize + ZSTD_estimateDCtxSize();
+
+	result.compressionSpeed = inputSize / 1e6 / std::max(compressionSeconds, 1e-9);
+	result.sequenceLatency = decompressionSeconds * 1000 / std::max(measuredBands, 1);
+	result.memory = std::max(compressionMemory, decompressionMemory) / 1e6;
+	return result;
+}
+
+/**
+ * Returns how far a result is from meeting the constraints, as the sum of the relative excess on each of them.
+ */
+static double constraintViolation(const TuningResult& result, const TuningConstraints& constraints) {
+	double violation = 0;
+	if (constraints.minCompressionSpeed > 0 && result.compressionSpeed < constraints.minCompressionSpeed) {
+		violation += constraints.minCompressionSpeed / result.compressionSpeed - 1;
+	}
+	if (constraints.maxSequenceLatency > 0 && result.sequenceLatency > constraints.maxSequenceLatency) {
+		violation += result.sequenceLatency / constraints.maxSequenceLatency - 1;
 	}
-	for (int row = 0; row < rect.width; ++row) {
+	if (constraints.maxMemory > 0 && result.memory > constraints.maxMemory) {
+		violation += result.memory / constraints.maxMemory - 1;
+	}
+	return violation;
+}
 
-		rect.sequences.push_back(sequences[row]);
+static bool isBetterResult(const TuningResult& a, const TuningResult& b, const TuningConstraints& constraints) {
+	double violationA = constraintViolation(a, constraints);
+	double violationB = constraintViolation(b, constraints);
+	if (violationA != violationB) {
+		return violationA < violationB;
 	}
+	return a.compressedSize < b.compressedSize;
 }
 
-void MSACompressor::splitSequencesIntoRectangles(const std::vector<Sequence>& sequences, int startX, std::vector<Rectangle>& rectangles, int A, int B) {
-	int numRows = sequences.size();
-	if (numRows == 0) return;
-	int numCols = sequences[0].data.size();
-	for (int x = 0; x < numRows; x += A) {
-		for (int y = 0; y < numCols; y += B) {
-			Rectangle rect;
-			rect.startX = startX;
-			rect.startY = y;
-			rect.width = std::min(A, numRows - x);
-			rect.height = std::min(B, numCols - y);
-			for (int i = 0; i < rect.width; ++i) {
-				Sequence seq = sequences[x + i];
-				Sequence subSeq;
-				subSeq.id = seq.id;
-				for (int j = 0; j < rect.height; ++j) {
-					subSeq.data.push_back(seq.data[y + j]);
+static bool dominates(const TuningResult& a, const TuningResult& b) {
+	bool noWorse = a.compressedSize <= b.compressedSize && a.compressionSpeed >= b.compressionSpeed
+		&& a.sequenceLatency <= b.sequenceLatency && a.memory <= b.memory;
+	bool better = a.compressedSize < b.compressedSize || a.compressionSpeed > b.compressionSpeed
+		|| a.sequenceLatency < b.sequenceLatency || a.memory < b.memory;
+	return noWorse && better;
+}
+
+static std::string configurationArguments(const CompressionOptions& options) {
+	std::ostringstream oss;
+	oss << "-a" << options.A << " -b" << options.B << " -z" << options.zstdLevel << " -p" << static_cast<int>(options.preprocessingType);
+	return oss.str();
+}
+
+void MSACompressor::tune(const std::string& inputFile, const std::string& outputFile, const CompressionOptions& options, const TuningConstraints& constraints) {
+	std::ifstream ifs(inputFile);
+	if (!ifs) {
+		std::cerr << "Error: Unable to open input file: " << inputFile << std::endl;
+		exit(1);
+	}
+
+	// the sample is the first rows of the alignment, so that bands keep their rows together
+	std::vector<std::string> headers;
+	std::vector<Sequence> sample;
+	std::string line;
+	readHeaders(ifs, headers, line);
+	size_t sampleSize = 0;
+	do {
+		if (line.empty() || line[0] == '/')
+			break;
+		Sequence seq;
+		parseSequence(line, seq);
+		sampleSize += seq.data.size();
+		sample.push_back(std::move(seq));
+	} while (sampleSize < TUNE_SAMPLE_SIZE && std::getline(ifs, line));
+	ifs.close();
+	if (sample.empty() || sample[0].data.empty()) {
+		std::cerr << "Error: No sequences to tune on in input file: " << inputFile << std::endl;
+		exit(1);
+	}
+
+	std::vector<int> rowCandidates;
+	for (int A : TUNE_ROW_CANDIDATES) {
+		if (A < static_cast<int>(sample.size()) || A == TUNE_ROW_CANDIDATES[0]) {
+			rowCandidates.push_back(A);
+		}
+	}
+	std::vector<int> columnCandidates;
+	for (int B : TUNE_COLUMN_CANDIDATES) {
+		if (B < static_cast<int>(sample[0].data.size()) || B == TUNE_COLUMN_CANDIDATES[0]) {
+			columnCandidates.push_back(B);
+		}
+	}
+
+	// the configuration measured is compressed without dictionaries, from the options given otherwise
+	CompressionOptions start = options;
+	start.dictionarySize = 0;
+	compressionDictionary.reset();
+	decompressionDictionary = NULL;
+
+	std::map<std::string, TuningResult> results;
+	auto measure = [&](const CompressionOptions& candidate) -> const TuningResult& {
+		std::string key = configurationArguments(candidate);
+		auto found = results.find(key);
+		if (found == results.end()) {
+			found = results.insert(std::make_pair(key, measureConfiguration(sample, candidate))).first;
+		}
+		return found->second;
+	};
+
+	std::cout << "Tuning on " << sample.size() << " rows of " << sample[0].data.size() << " columns." << std::endl;
+	TuningResult best = measure(start);
+	for (int round = 0; round < TUNE_MAX_ROUNDS; ++round) {
+		TuningResult roundBest = best;
+		for (int setting = 0; setting < 4; ++setting) {
+			std::vector<CompressionOptions> neighbours;
+			CompressionOptions neighbour = best.options;
+			if (setting == 0) {
+				for (int A : rowCandidates) {
+					neighbour.A = A;
+					neighbours.push_back(neighbour);
+				}
+			}
+			else if (setting == 1) {
+				for (int B : columnCandidates) {
+					neighbour.B = B;
+					neighbours.push_back(neighbour);
+				}
+			}
+			else if (setting == 2) {
+				for (int level : TUNE_LEVEL_CANDIDATES) {
+					neighbour.zstdLevel = level;
+					neighbours.push_back(neighbour);
+				}
+			}
+			else {
+				for (PreprocessingType type : TUNE_PREPROCESSING_CANDIDATES) {
+					neighbour.preprocessingType = type;
+					neighbours.push_back(neighbour);
+				}
+			}
+			for (const auto& candidate : neighbours) {
+				const TuningResult& result = measure(candidate);
+				if (isBetterResult(result, roundBest, constraints)) {
+					roundBest = result;
 				}
-				rect.sequences.push_back(subSeq);
 			}
-			rectangles.push_back(std::move(rect));
 		}
+		if (!isBetterResult(roundBest, best, constraints)) {
+			break;
+		}
+		best = roundBest;
 	}
-}
 
-MSACompressor::MSACompressor() {
+	std::vector<const TuningResult*> tried;
+	for (const auto& entry : results) {
+		tried.push_back(&entry.second);
+	}
+	std::sort(tried.begin(), tried.end(), [](const TuningResult* a, const TuningResult* b) {
+		return a->compressedSize < b->compressedSize;
+	});
+
+	char row[256];
+	std::snprintf(row, sizeof(row), "%-32s %12s %10s %12s %10s  %s", "configuration", "size", "MB/s", "Ds ms", "memory MB", "");
+	std::cout << row << std::endl;
+	for (const TuningResult* result : tried) {
+		bool paretoOptimal = true;
+		for (const TuningResult* other : tried) {
+			if (dominates(*other, *result)) {
+				paretoOptimal = false;
+				break;
+			}
+		}
+		const char* mark = "";
+		if (constraintViolation(*result, constraints) > 0) {
+			mark = "over constraints";
+		}
+		else if (paretoOptimal) {
+			mark = "pareto";
+		}
+		std::snprintf(row, sizeof(row), "%-32s %12llu %10.1f %12.3f %10.1f  %s", configurationArguments(result->options).c_str(),
+			static_cast<unsigned long long>(result->compressedSize), result->compressionSpeed, result->sequenceLatency, result->memory, mark);
+		std::cout << row << std::endl;
+	}
 
+	if (constraintViolation(best, constraints) > 0) {
+		std::cerr << "Warning: No configuration tried meets the constraints, using the closest one." << std::endl;
+	}
+	std::cout << "Best configuration: " << configurationArguments(best.options) << std::endl;
+
+	if (outputFile != STANDARD_OUTPUT) {
+		CompressionOptions chosen = options;
+		chosen.A = best.options.A;
+		chosen.B = best.options.B;
+		chosen.zstdLevel = best.options.zstdLevel;
+		chosen.preprocessingType = best.options.preprocessingType;
+		compress(inputFile, outputFile, chosen);
+	}
 }
 
 void MSACompressor::printUsage() {
@@ -555,12 +1315,49 @@ void MSACompressor::printUsage() {
 	std::cout << "  Sd             Decompress the file.\n";
 	std::cout << "  Ds             Decompress sequences.\n";
 	std::cout << "  Dc             Decompress columns.\n";
-	std::cout << "  Drc            Decompress a range of columns.\n\n";
+	std::cout << "  Drc            Decompress a range of columns.\n";
+	std::cout << "  Dsr            Decompress a range of columns of sequences, reading only the rectangles holding both.\n";
+	std::cout << "  Db             Answer the Ds, Dsr, Dc and Drc queries of a manifest file together, decoding each rectangle once.\n";
+	std::cout << "                 Every line holds a mode, an output file (shared by queries to concatenate them) and the arguments:\n";
+	std::cout << "                 MSAC.exe Db <input_file> <manifest_file> [options]\n";
+	std::cout << "  Tc             Tune -a, -b, -z and -p on a sample of the file, print the configurations tried and compress the file\n";
+	std::cout << "                 with the best one (output file - to only print), under the constraints -C, -Q and -M\n";
+	std::cout << "  Lc             Build a dictionary library, one dictionary per Pfam clan (#=GF CL), from several files:\n";
+	std::cout << "                 MSAC.exe Lc <library_file> <input_file> <input_file> ... [options]\n";
+	std::cout << "  serve          Keep archives open and answer Ds, Dsr, Dc and Drc queries sent to a Unix domain socket:\n";
+	std::cout << "                 MSAC.exe serve <socket_file> <input_file> <input_file> ... [options]\n\n";
 
 	std::cout << "Options:\n";
 	std::cout << "  -a<number>     Set value A (number of rows in the rectangle) (default: 200000)\n";
 	std::cout << "  -b<number>     Set value B (number of columns in the rectangle) (default: 10000)\n";
-	std::cout << "  -z<number>     Compression level for Zstd (from 1 to 19) (default: 13)\n";
+	std::cout << "  -z<number>     Compression level for Zstd, from the negative fast levels (e.g. -z-5) to the ultra levels 20 to 22\n";
+	std::cout << "                 (default: 13)\n";
+	std::cout << "  -w<number>     Base-2 logarithm of the Zstd window size (from 10 to 30 or 31), 0 to let the level choose (default: 0)\n";
+	std::cout << "  -s<number>     Zstd strategy: 1 fast, 2 dfast, 3 greedy, 4 lazy, 5 lazy2, 6 btlazy2, 7 btopt, 8 btultra,\n";
+	std::cout << "                 9 btultra2, 0 to let the level choose (default: 0)\n";
+	std::cout << "  -l             Enable Zstd long distance matching, for large rectangles (not together with -v)\n";
+	std::cout << "  -d<number>     Size in KB of a dictionary trained for the archive and shared by all rectangles,\n";
+	std::cout << "                 which helps small rectangles (e.g. -d112), 0 for none (default: 0)\n";
+	std::cout << "  -L<file>       Dictionary library: Sc compresses with the dictionary of the clan of the family,\n";
+	std::cout << "                 the other modes need it for files compressed that way\n";
+	std::cout << "  -H             Code rectangles with Huffman only, as literals without matches: larger output decoded faster\n";
+	std::cout << "  -G<number>     Compress each rectangle against the previous one of its band in groups of this many rectangles,\n";
+	std::cout << "                 a larger group giving a better ratio and slower access to columns, 1 for none (default: 1).\n";
+	std::cout << "                 Not used with dictionaries\n";
+	std::cout << "  -v             Find matches with a match finder specialized for alignments, comparing each symbol with the\n";
+	std::cout << "                 same column of the previous rows and with the last rows it found, leaving to the level's own\n";
+	std::cout << "                 match finders the blocks it does not shrink enough. Only used at levels 10 to 15, where it is\n";
+	std::cout << "                 smaller and faster than their own, and for rectangles with no preprocessing (-p0, or chosen by -p8).\n";
+	std::cout << "                 Not used with dictionaries and -H, nor for the rectangles chained by -G\n";
+	std::cout << "  -T<number>     Number of threads compressing or decompressing (Sd) rectangles, or answering requests (serve),\n";
+	std::cout << "                 0 for all cores (default: 1, all cores for serve)\n";
+	std::cout << "  -K<number>     Ds, Dsr, Dc, Drc, Db and serve: size in MB of the cache of decoded rectangles kept for each archive,\n";
+	std::cout << "                 0 to disable it (default: 256)\n";
+	std::cout << "  -S             Sd only: write the output sequentially, one band of rows at a time, instead of mapping it\n";
+	std::cout << "                 into memory (used automatically for pipes and for the standard output, given as -)\n";
+	std::cout << "  -C<number>     Tc only: minimum compression speed of one thread in MB/s\n";
+	std::cout << "  -Q<number>     Tc only: maximum time to decompress one sequence (Ds) in milliseconds\n";
+	std::cout << "  -M<number>     Tc only: maximum memory used to compress or decompress in MB\n";
 	std::cout << "  -p<number>     Preprocessing mode:\n";
 	std::cout << "                 0 - no preprocessing\n";
 	std::cout << "                 1 - reduce gaps ver1\n";
@@ -568,17 +1365,34 @@ void MSACompressor::printUsage() {
 	std::cout << "                 3 - reduce gaps ver3\n";
 	std::cout << "                 4 - reduce gaps and convert to lowercase\n";
 	std::cout << "                 5 - reduce gaps and convert to uppercase\n";
+	std::cout << "                 6 - Burrows-Wheeler + move-to-front transform by rows\n";
+	std::cout << "                 7 - Burrows-Wheeler + move-to-front transform by columns\n";
+	std::cout << "                 8 - automatic, lossless method chosen for each rectangle\n";
+	std::cout << "                 (when decompressing, only needed for files written by older versions)\n";
 
 	std::cout << "\nExamples:\n";
 
 	std::cout << "  MSAC.exe Sc input.txt output.msac -a5 -b10 -z3 -p1\n";
+	std::cout << "  MSAC.exe Sc input.txt output.msac -a1000 -b1000 -z19 -T0\n";
+	std::cout << "  MSAC.exe Sc input.txt output.msac -a1 -b1000 -z19 -d112\n";
+	std::cout << "  MSAC.exe Sc input.txt output.msac -z12 -p0 -v\n";
+	std::cout << "  MSAC.exe Sc input.txt output.msac -z22 -w27 -l\n";
+	std::cout << "  MSAC.exe Sc input.txt output.msac -a1000 -b500 -G8\n";
+	std::cout << "  MSAC.exe Sc input.txt output.msac -z-5 -T0\n";
+	std::cout << "  MSAC.exe Lc families.msacl family1.txt family2.txt family3.txt -a1 -b1000 -d64\n";
+	std::cout << "  MSAC.exe Sc family1.txt family1.msac -a1 -b1000 -Lfamilies.msacl\n";
+	std::cout << "  MSAC.exe Tc input.txt output.msac -C20 -Q5\n";
 	std::cout << "  MSAC.exe Sd input.msac output.txt -p3\n";
 	std::cout << "  MSAC.exe Ds input.msac output.txt <SequenceId> <SequenceId> ...\n";
 	std::cout << "  MSAC.exe Dc input.msac output.txt <ColumnNumber> ...\n";
 	std::cout << "  MSAC.exe Drc input.msac output.txt <StartColumnNumber> <StopColumnNumber>\n";
+	std::cout << "  MSAC.exe Dsr input.msac output.txt <StartColumnNumber> <StopColumnNumber> <SequenceId> ...\n";
+	std::cout << "  MSAC.exe Db input.msac queries.txt\n";
+	std::cout << "  MSAC.exe serve /tmp/msac.sock family1.msac family2.msac -T4 -K512\n";
 }
 
-void MSACompressor::compress(const std::string& inputFile, const std::string& outputFile, int zstdLevel, int A, int B, PreprocessingType preprocessingType) {
+void MSACompressor::compress(const std::string& inputFile, const std::string& outputFile, const CompressionOptions& requestedOptions) {
+	CompressionOptions options = requestedOptions;
 
 	std::ifstream ifs(inputFile);
 	if (!ifs) {
@@ -594,16 +1408,7 @@ void MSACompressor::compress(const std::string& inputFile, const std::string& ou
 
 	std::vector<std::string> headers;
 	std::string line;
-	while (std::getline(ifs, line)) {
-		if (line.empty() || line[0] == '/') {
-			continue;
-		}
-		if (line[0] == '#') {
-			headers.push_back(line);
-			continue;
-		}
-		break;
-	}
+	readHeaders(ifs, headers, line);
 
 	for (const auto& header : headers) {
 		ofs.write(header.c_str(), header.size());
@@ -613,66 +1418,115 @@ void MSACompressor::compress(const std::string& inputFile, const std::string& ou
 	uint64_t dataStartPos = ofs.tellp();
 	std::vector<std::string> uniqueIds;
 	std::vector<Sequence> sequences;
-	std::vector<std::tuple<int, int, int, int, uint64_t>> footer;
+	std::vector<FooterEntry> footer;
 	int currentX = 0;
 
+	// Rectangles are compressed concurrently when more threads are requested. Otherwise they are compressed one by one
+	// and the pool only runs the trials of the automatic preprocessing choice.
+	bool parallelRectangles = options.threads > 1;
+	ThreadPool pool(parallelRectangles ? options.threads : (options.preprocessingType == AUTO_PREPROCESSING ? std::thread::hardware_concurrency() : 1));
+	std::deque<CompressionBand> pendingBands;
+	size_t pendingRectangles = 0;
+	size_t maxPendingRectangles = parallelRectangles ? 4 * pool.size() : 0;
+
+	// rectangles repeating the cells of an earlier one are found before they are compressed
+	PayloadIndex payloads;
+
+	// With a dictionary, bands are held back until enough rows are read to train it
+	compressionDictionary.reset();
+	std::vector<char> dictionary;
+	bool trainingDictionary = options.dictionarySize > 0;
+	size_t trainingBytes = 0;
+
+	// A dictionary from a library, chosen by the clan of the family, replaces the one trained for the archive
+	uint32_t libraryDictionaryId = 0;
+	if (!dictionaryLibraryFile.empty()) {
+		DictionaryLibrary library;
+		if (!library.load(dictionaryLibraryFile)) {
+			std::cerr << "Error: Unable to read dictionary library: " << dictionaryLibraryFile << std::endl;
+			exit(1);
+		}
+		std::string clan = findClan(headers);
+		const LibraryDictionary* libraryDictionary = library.findByClan(clan);
+		if (libraryDictionary == NULL) {
+			std::cerr << "Warning: No dictionary for clan '" << clan << "' in library " << dictionaryLibraryFile << "." << std::endl;
+		}
+		else {
+			compressionDictionary.reset(ZSTD_createCDict(libraryDictionary->data.data(), libraryDictionary->data.size(), options.zstdLevel));
+			if (!compressionDictionary) {
+				std::cerr << "Error: Unable to create a compression dictionary." << std::endl;
+				exit(1);
+			}
+			libraryDictionaryId = libraryDictionary->id;
+			trainingDictionary = false;
+		}
+	}
+
+	// a chained rectangle is compressed against the previous one instead of the dictionary, which costs more than it saves
+	if (options.tileGroupSize > 1 && (trainingDictionary || compressionDictionary)) {
+		std::cerr << "Warning: Tile groups (-G) are not used with a dictionary (-d, -L), compressing each rectangle on its own." << std::endl;
+		options.tileGroupSize = 1;
+	}
+
 	do {
-		std::istringstream iss(line);
 		if (line[0] == '/')
 			break;
-		std::string id;
-		std::string data;
-		iss >> id >> data;
-		Sequence seq = { id, {} };
-		char lastSymbol = '\0';
-
-		for (char c : data) {
-			if (lastSymbol != '\0') {
-				seq.data.emplace_back(lastSymbol);
-			}
-			lastSymbol = c;
-		}
-		if (lastSymbol != '\0') {
-			seq.data.emplace_back(lastSymbol);
-		}
+		Sequence seq;
+		parseSequence(line, seq);
 		sequences.push_back(std::move(seq));
 
-		if (sequences.size() >= A) {
-			std::vector<Rectangle> rectangles;
-			splitSequencesIntoRectangles(sequences, currentX, rectangles, A, B);
-			for (auto& rect : rectangles) {
-				compressRectangle(rect, zstdLevel, preprocessingType);
-				//compressRectangleByColumn(rect, zstdLevel, preprocessingType);
-				ofs.write(rect.compressedData.data(), rect.compressedData.size());
-				if (rect.startY == 0) {
-					for (const auto& seq : rect.sequences) {
-						uniqueIds.push_back(seq.id);
+		if (sequences.size() >= static_cast<size_t>(options.A)) {
+			queueBand(sequences, currentX, options, pendingBands);
+			pendingRectangles += pendingBands.back().rectangles.size();
+			currentX += options.A;
+			sequences.clear();
+
+			if (!trainingDictionary) {
+				submitBand(pendingBands.back(), options, pool, payloads);
+			}
+			else {
+				for (const auto& seq : pendingBands.back().sequences) {
+					trainingBytes += seq.data.size();
+				}
+				if (trainingBytes >= options.dictionarySize * DICTIONARY_SAMPLE_RATIO) {
+					trainDictionary(pendingBands, options, dictionary);
+					trainingDictionary = false;
+					for (auto& band : pendingBands) {
+						submitBand(band, options, pool, payloads);
 					}
 				}
-				uint64_t compressedSize = rect.compressedData.size();
-				footer.emplace_back(rect.startX, rect.startY, rect.width, rect.height, compressedSize);
+				continue;
+			}
+
+			// payloads are written in input order while later bands are still being compressed
+			while (!pendingBands.empty() && (pendingBands.size() > 1 || !parallelRectangles) && pendingRectangles > maxPendingRectangles) {
+				pendingRectangles -= pendingBands.front().rectangles.size();
+				writeBand(pendingBands.front(), ofs, uniqueIds, footer);
+				pendingBands.pop_front();
 			}
-			currentX += A;
-			sequences.clear();
 		}
 	} while (std::getline(ifs, line));
 
 	if (!sequences.empty()) {
-		std::vector<Rectangle> rectangles;
-		splitSequencesIntoRectangles(sequences, currentX, rectangles, A, B);
-		for (auto& rect : rectangles) {
-			compressRectangle(rect, zstdLevel, preprocessingType);
-			//compressRectangleByColumn(rect, zstdLevel, preprocessingType);
-			ofs.write(rect.compressedData.data(), rect.compressedData.size());
-			if (rect.startY == 0) {
-				for (const auto& seq : rect.sequences) {
-					uniqueIds.push_back(seq.id);
-				}
-			}
-			uint64_t compressedSize = rect.compressedData.size();
-			footer.emplace_back(rect.startX, rect.startY, rect.width, rect.height, compressedSize);
+		queueBand(sequences, currentX, options, pendingBands);
+		if (!trainingDictionary) {
+			submitBand(pendingBands.back(), options, pool, payloads);
 		}
 	}
+	if (trainingDictionary) {
+		trainDictionary(pendingBands, options, dictionary);
+		for (auto& band : pendingBands) {
+			submitBand(band, options, pool, payloads);
+		}
+	}
+	while (!pendingBands.empty()) {
+		writeBand(pendingBands.front(), ofs, uniqueIds, footer);
+		pendingBands.pop_front();
+	}
+
+	uint64_t dictionaryStartPos = ofs.tellp();
+	ofs.write(dictionary.data(), dictionary.size());
+	compressionDictionary.reset();
 
 	uint64_t sequenceIdsStartPos = ofs.tellp();
 
@@ -685,403 +1539,835 @@ void MSACompressor::compress(const std::string& inputFile, const std::string& ou
 	uint64_t footerStartPos = ofs.tellp();
 
 	for (const auto& entry : footer) {
-		int startX, startY, width, height;
-		uint64_t compressedSize;
-		std::tie(startX, startY, width, height, compressedSize) = entry;
-
-		ofs.write(reinterpret_cast<const char*>(&startX), sizeof(startX));
-		ofs.write(reinterpret_cast<const char*>(&startY), sizeof(startY));
-		ofs.write(reinterpret_cast<const char*>(&width), sizeof(width));
-		ofs.write(reinterpret_cast<const char*>(&height), sizeof(height));
-		ofs.write(reinterpret_cast<const char*>(&compressedSize), sizeof(compressedSize));
+		uint8_t preprocessingType = static_cast<uint8_t>(entry.preprocessingType);
+		uint8_t codec = static_cast<uint8_t>(entry.codec);
+
+		ofs.write(reinterpret_cast<const char*>(&entry.startX), sizeof(entry.startX));
+		ofs.write(reinterpret_cast<const char*>(&entry.startY), sizeof(entry.startY));
+		ofs.write(reinterpret_cast<const char*>(&entry.width), sizeof(entry.width));
+		ofs.write(reinterpret_cast<const char*>(&entry.height), sizeof(entry.height));
+		ofs.write(reinterpret_cast<const char*>(&entry.compressedSize), sizeof(entry.compressedSize));
+		ofs.write(reinterpret_cast<const char*>(&preprocessingType), sizeof(preprocessingType));
+		ofs.write(reinterpret_cast<const char*>(&codec), sizeof(codec));
 	}
 
 	ofs.write(reinterpret_cast<const char*>(&dataStartPos), sizeof(dataStartPos));
 	ofs.write(reinterpret_cast<const char*>(&sequenceIdsStartPos), sizeof(sequenceIdsStartPos));
 	ofs.write(reinterpret_cast<const char*>(&footerStartPos), sizeof(footerStartPos));
+	ofs.write(reinterpret_cast<const char*>(&dictionaryStartPos), sizeof(dictionaryStartPos));
+	ofs.write(reinterpret_cast<const char*>(&libraryDictionaryId), sizeof(libraryDictionaryId));
+	writeParameters(ofs, zstdParameters(options));
+	uint32_t tileGroupSize = static_cast<uint32_t>(std::max(options.tileGroupSize, 1));
+	ofs.write(reinterpret_cast<const char*>(&tileGroupSize), sizeof(tileGroupSize));
+	ofs.write(reinterpret_cast<const char*>(&ARCHIVE_VERSION), sizeof(ARCHIVE_VERSION));
+	ofs.write(reinterpret_cast<const char*>(&ARCHIVE_MAGIC), sizeof(ARCHIVE_MAGIC));
 
 	ofs.close();
 }
 
-void MSACompressor::decompress(const std::string& inputFile, const std::string& outputFile, PreprocessingType preprocesingType) {
+void MSACompressor::decompress(const std::string& inputFile, const std::string& outputFile, PreprocessingType preprocesingType, int threads, bool sequentialOutput) {
 	std::ifstream ifs(inputFile, std::ios::binary);
 	if (!ifs) {
 		std::cerr << "Error: Unable to open input file: " << inputFile << std::endl;
 		exit(1);
 	}
 
-	ifs.seekg(-static_cast<int>(3 * sizeof(uint64_t)), std::ios::end);
 	uint64_t dataStartPos, sequenceIdsStartPos, footerStartPos;
-	ifs.read(reinterpret_cast<char*>(&dataStartPos), sizeof(dataStartPos));
-	ifs.read(reinterpret_cast<char*>(&sequenceIdsStartPos), sizeof(sequenceIdsStartPos));
-	ifs.read(reinterpret_cast<char*>(&footerStartPos), sizeof(footerStartPos));
-
-	ifs.seekg(footerStartPos, std::ios::beg);
-	std::vector<std::tuple<int, int, int, int, uint64_t>> footer;
-	int resultSize = 0;
-	while (true) {
-		int startX, startY, width, height;
-		uint64_t compressedSize;
-
-		ifs.read(reinterpret_cast<char*>(&startX), sizeof(startX));
-		if (startX == dataStartPos)break;
-		ifs.read(reinterpret_cast<char*>(&startY), sizeof(startY));
-		ifs.read(reinterpret_cast<char*>(&width), sizeof(width));
-		ifs.read(reinterpret_cast<char*>(&height), sizeof(height));
-		ifs.read(reinterpret_cast<char*>(&compressedSize), sizeof(compressedSize));
-
-		footer.emplace_back(startX, startY, width, height, compressedSize);
-		if (startX == 0) {
-			resultSize += height;
+	std::vector<FooterEntry> footer;
+	readFooter(ifs, dataStartPos, sequenceIdsStartPos, footerStartPos, footer, preprocesingType);
+	uint64_t resultSize = 0;
+	for (const auto& entry : footer) {
+		if (entry.startX == 0) {
+			resultSize += entry.height;
 		}
 	}
 
-	std::ofstream ofs(outputFile);
-	if (!ofs) {
-		std::cerr << "Error: Unable to open output file: " << outputFile << std::endl;
-		exit(1);
-	}
-
 	ifs.clear();
 	ifs.seekg(0);
+	std::vector<std::string> headers;
 	while (ifs.tellg() < dataStartPos) {
 		std::string header;
 		std::getline(ifs, header);
-		ofs << header << std::endl;
+		headers.push_back(header);
 	}
 
 	std::vector<std::string> sequenceIds;
 	ifs.seekg(sequenceIdsStartPos, std::ios::beg);
-	std::streampos lineStartPos = ofs.tellp();
-	std::unordered_map<std::string, std::streampos> seqIdPositions;
-
 	while (ifs.tellg() < footerStartPos) {
 		uint16_t idLength;
 		ifs.read(reinterpret_cast<char*>(&idLength), sizeof(idLength));
 		std::string id(idLength, ' ');
 		ifs.read(&id[0], idLength);
 		sequenceIds.push_back(id);
-		ofs << id << " ";
-		if (id.size() < 25) { ofs << std::string((25 - id.size()), ' '); }
-		seqIdPositions[id] = ofs.tellp();
-		ofs << std::string(resultSize, ' ');
-		ofs << std::endl;
 	}
 
-	ofs.close();
+	ThreadPool pool(threads);
+	ifs.seekg(dataStartPos, std::ios::beg);
+	if (sequentialOutput || !isMappableOutput(outputFile) || !writeMappedOutput(ifs, outputFile, footer, headers, sequenceIds, resultSize, pool)) {
+		ifs.clear();
+		ifs.seekg(dataStartPos, std::ios::beg);
+		writeOutputByBands(ifs, outputFile, footer, headers, sequenceIds, resultSize, pool);
+	}
 	ifs.close();
+}
 
-	std::fstream ofsUpdate(outputFile, std::ios::in | std::ios::out);
-	if (!ofsUpdate) {
-		std::cerr << "Error: Unable to open output file for updating: " << outputFile << std::endl;
-		exit(1);
+bool MSACompressor::readRectangle(std::ifstream& ifs, const std::vector<FooterEntry>& footer, size_t index, Rectangle& rect, size_t sequenceCount, uint64_t resultSize) {
+	const FooterEntry& entry = footer[index];
+	rect.startX = entry.startX;
+	rect.startY = entry.startY;
+	rect.width = entry.width;
+	rect.height = entry.height;
+	rect.codec = entry.codec;
+	rect.compressedData.resize(entry.compressedSize);
+
+	ifs.read(rect.compressedData.data(), entry.compressedSize);
+	if (!ifs) {
+		std::cerr << "Error: Unable to read compressed data for rectangle at ("
+			<< entry.startX << ", " << entry.startY << "). Expected size: " << entry.compressedSize << std::endl;
+		return false;
+	}
+	bool outside = entry.startX < 0 || entry.startY < 0 || entry.width < 0 || entry.height < 0
+		|| static_cast<uint64_t>(entry.startX) + entry.width > sequenceCount || static_cast<uint64_t>(entry.startY) + entry.height > resultSize;
+	if (outside) {
+		std::cerr << "Error: Rectangle at (" << entry.startX << ", " << entry.startY << ") lies outside the alignment." << std::endl;
 	}
+	if (outside || (entry.codec == DUPLICATE_CODEC && !resolveDuplicate(ifs, footer, index, rect))) {
+		rect = Rectangle();
+		rect.startX = 0;
+		rect.startY = 0;
+		rect.width = 0;
+		rect.height = 0;
+	}
+	return true;
+}
 
-	ifs.open(inputFile, std::ios::binary);
-	ifs.seekg(dataStartPos, std::ios::beg);
+/**
+ * Reads the index of the rectangle a duplicate refers to, which has to come earlier in the footer and not be a duplicate itself.
+ */
+static bool findDuplicateSource(const std::vector<char>& data, const std::vector<FooterEntry>& footer, size_t index, uint32_t& original) {
+	original = 0;
+	if (data.size() == sizeof(original)) {
+		std::memcpy(&original, data.data(), sizeof(original));
+	}
+	return data.size() == sizeof(original) && original < index && footer[original].codec != DUPLICATE_CODEC;
+}
 
-	for (const auto& entry : footer) {
-		int startX, startY, width, height;
-		uint64_t compressedSize;
-		std::tie(startX, startY, width, height, compressedSize) = entry;
+bool MSACompressor::resolveDuplicate(std::ifstream& ifs, const std::vector<FooterEntry>& footer, size_t index, Rectangle& rect) {
+	uint32_t original;
+	if (!findDuplicateSource(rect.compressedData, footer, index, original)) {
+		std::cerr << "Error: Rectangle at (" << rect.startX << ", " << rect.startY << ") duplicates an invalid rectangle." << std::endl;
+		return false;
+	}
 
-		Rectangle rect;
-		rect.startX = startX;
-		rect.startY = startY;
-		rect.width = width;
-		rect.height = height;
-		rect.compressedData.resize(compressedSize);
+	const FooterEntry& source = footer[original];
+	std::streampos position = ifs.tellg();
+	rect.compressedData.resize(source.compressedSize);
+	ifs.seekg(source.offset, std::ios::beg);
+	ifs.read(rect.compressedData.data(), source.compressedSize);
+	bool readable = static_cast<bool>(ifs);
+	ifs.clear();
+	ifs.seekg(position);
+	if (!readable) {
+		std::cerr << "Error: Unable to read the rectangle duplicated by the rectangle at (" << rect.startX << ", " << rect.startY << ")." << std::endl;
+		return false;
+	}
+	rect.codec = source.codec;
+	return true;
+}
 
-		ifs.read(rect.compressedData.data(), compressedSize);
-		if (!ifs) {
-			std::cerr << "Error: Unable to read compressed data for rectangle at ("
-				<< startX << ", " << startY << "). Expected size: " << compressedSize << std::endl;
-			return;
+// Fills the cells of a rectangle that is not decoded with spaces, as the band writer leaves them, within the alignment.
+static void blankCells(char* outputData, const std::vector<uint64_t>& rowOffsets, const FooterEntry& entry, uint64_t resultSize) {
+	if (entry.startX < 0 || entry.startY < 0 || static_cast<uint64_t>(entry.startY) >= resultSize) {
+		return;
+	}
+	uint64_t rowEnd = std::min<uint64_t>(static_cast<uint64_t>(entry.startX) + std::max(entry.width, 0), rowOffsets.size());
+	uint64_t columnEnd = std::min<uint64_t>(static_cast<uint64_t>(entry.startY) + std::max(entry.height, 0), resultSize);
+	for (uint64_t row = entry.startX; row < rowEnd; ++row) {
+		std::memset(outputData + rowOffsets[row] + entry.startY, ' ', columnEnd - entry.startY);
+	}
+}
+
+bool MSACompressor::writeMappedOutput(std::ifstream& ifs, const std::string& outputFile, const std::vector<FooterEntry>& footer, const std::vector<std::string>& headers, const std::vector<std::string>& sequenceIds, uint64_t resultSize, ThreadPool& pool) {
+	// Every output line has a known length, so the position of each row is computed up front
+	// and the rectangles can be decoded straight into the mapped output, in any order.
+	uint64_t outputSize = 0;
+	for (const auto& header : headers) {
+		outputSize += header.size() + NEWLINE_LENGTH;
+	}
+	std::vector<uint64_t> rowOffsets(sequenceIds.size());
+	for (size_t i = 0; i < sequenceIds.size(); ++i) {
+		rowOffsets[i] = outputSize + idColumnSize(sequenceIds[i]);
+		outputSize += idColumnSize(sequenceIds[i]) + resultSize + NEWLINE_LENGTH;
+	}
+
+	MappedOutputFile output;
+	if (!output.open(outputFile, outputSize)) {
+		return false;
+	}
+	char* outputData = output.data();
+
+	char* position = outputData;
+	for (const auto& header : headers) {
+		position = writeLine(position, header);
+	}
+	for (size_t i = 0; i < sequenceIds.size(); ++i) {
+		writeIdColumn(position, sequenceIds[i]);
+		std::memcpy(outputData + rowOffsets[i] + resultSize, NEWLINE, NEWLINE_LENGTH);
+		position = outputData + rowOffsets[i] + resultSize + NEWLINE_LENGTH;
+	}
+
+	// The rectangles of a tile group are decoded in order by one task, each against the previous one
+	bool chained = archiveTileGroupSize > 1;
+	std::deque<std::future<void>> pendingGroups;
+	std::vector<std::shared_ptr<Rectangle>> group;
+	std::vector<PreprocessingType> groupTypes;
+	for (size_t i = 0; i < footer.size(); ++i) {
+		std::shared_ptr<Rectangle> rect = std::make_shared<Rectangle>();
+		bool readable = readRectangle(ifs, footer, i, *rect, sequenceIds.size(), resultSize);
+		if (readable && rect->width == 0) {
+			blankCells(outputData, rowOffsets, footer[i], resultSize);
+		}
+		if (readable) {
+			group.push_back(rect);
+			groupTypes.push_back(footer[i].preprocessingType);
+			if (i + 1 < footer.size() && footer[i + 1].chained) {
+				continue;
+			}
 		}
 
-		reversePreprocessing(rect, preprocesingType, sequenceIds);
+		if (!group.empty()) {
+			pendingGroups.push_back(pool.submit([this, group, groupTypes, chained, outputData, &rowOffsets]() {
+				std::vector<char> chain;
+				std::vector<char*> rows;
+				for (size_t j = 0; j < group.size(); ++j) {
+					const Rectangle& rect = *group[j];
+					if (rect.width == 0) {
+						chain.clear();
+						continue;
+					}
+					rows.resize(rect.width);
+					for (int row = 0; row < rect.width; ++row) {
+						rows[row] = outputData + rowOffsets[rect.startX + row] + rect.startY;
+					}
+					decodeRectangle(rect, groupTypes[j], rows.data(), chained ? &chain : NULL);
+				}
+			}));
+			group.clear();
+			groupTypes.clear();
+		}
+		if (!readable) {
+			// the rectangles left are not read, so their cells are blank like the ones of the band writer
+			for (size_t j = i; j < footer.size(); ++j) {
+				blankCells(outputData, rowOffsets, footer[j], resultSize);
+			}
+			break;
+		}
 
-		for (const auto& seq : rect.sequences) {
-			auto pos = seqIdPositions[seq.id];
-			ofsUpdate.seekp(pos, std::ios::beg);
-			ofsUpdate << std::string(seq.data.begin(), seq.data.end());
-			std::streampos lenght = seq.data.size();
-			seqIdPositions[seq.id] = ofsUpdate.tellp();
+		// bounds the compressed data held by rectangles waiting for a thread
+		while (pendingGroups.size() > 4 * pool.size()) {
+			pendingGroups.front().get();
+			pendingGroups.pop_front();
 		}
 	}
+	while (!pendingGroups.empty()) {
+		pendingGroups.front().get();
+		pendingGroups.pop_front();
+	}
 
-	ofsUpdate.close();
-	ifs.close();
+	output.close();
+	return true;
 }
 
-void MSACompressor::decompressSequences(const std::string& inputFile, const std::string& outputFile, std::vector<std::string>& chosenSequenceIds, PreprocessingType preprocessingType) {
-	std::ifstream ifs(inputFile, std::ios::binary);
-	if (!ifs) {
-		std::cerr << "Error: Unable to open input file: " << inputFile << std::endl;
-		exit(1);
+void MSACompressor::writeOutputByBands(std::ifstream& ifs, const std::string& outputFile, const std::vector<FooterEntry>& footer, const std::vector<std::string>& headers, const std::vector<std::string>& sequenceIds, uint64_t resultSize, ThreadPool& pool) {
+	std::ofstream ofs;
+	std::ostream* out = &std::cout;
+	if (outputFile == STANDARD_OUTPUT) {
+		setBinaryMode(stdout);
+	}
+	else {
+		ofs.open(outputFile, std::ios::binary);
+		if (!ofs) {
+			std::cerr << "Error: Unable to open output file: " << outputFile << std::endl;
+			exit(1);
+		}
+		out = &ofs;
 	}
 
-	ifs.seekg(-static_cast<int>(3 * sizeof(uint64_t)), std::ios::end);
-	uint64_t dataStartPos, sequenceIdsStartPos, footerStartPos;
-	ifs.read(reinterpret_cast<char*>(&dataStartPos), sizeof(dataStartPos));
-	ifs.read(reinterpret_cast<char*>(&sequenceIdsStartPos), sizeof(sequenceIdsStartPos));
-	ifs.read(reinterpret_cast<char*>(&footerStartPos), sizeof(footerStartPos));
+	std::string headerLines;
+	for (const auto& header : headers) {
+		headerLines += header;
+		headerLines.append(NEWLINE, NEWLINE_LENGTH);
+	}
+	out->write(headerLines.data(), headerLines.size());
+
+	// Rectangles of one band share its rows, so all of them are decoded into a buffer holding the complete lines
+	// of the band, which is then written at once. Bands are written in order and only one is kept in memory.
+	std::vector<char> band;
+	std::vector<uint64_t> rowOffsets;
+	std::vector<std::shared_ptr<Rectangle>> bandRectangles;
+	std::vector<PreprocessingType> bandTypes;
+	std::vector<bool> bandChained;
+	std::vector<std::future<void>> pendingGroups;
+	bool chained = archiveTileGroupSize > 1;
+	size_t entryIndex = 0;
+	size_t writtenRows = 0;
+
+	while (entryIndex < footer.size()) {
+		int bandStart = footer[entryIndex].startX;
+		size_t bandEnd = entryIndex;
+		while (bandEnd < footer.size() && footer[bandEnd].startX == bandStart) {
+			++bandEnd;
+		}
 
-	ifs.seekg(footerStartPos, std::ios::beg);
-	std::vector<std::tuple<int, int, int, int, uint64_t>> footer;
-	int resultSize = 0;
-	while (true) {
-		int startX, startY, width, height;
-		uint64_t compressedSize;
+		bandRectangles.clear();
+		bandTypes.clear();
+		bandChained.clear();
+		for (size_t i = entryIndex; i < bandEnd; ++i) {
+			std::shared_ptr<Rectangle> rect = std::make_shared<Rectangle>();
+			if (!readRectangle(ifs, footer, i, *rect, sequenceIds.size(), resultSize)) {
+				bandEnd = footer.size();
+				break;
+			}
+			if (rect->width > 0) {
+				// a rectangle whose predecessor is missing starts a group of its own
+				bandChained.push_back(footer[i].chained && i > entryIndex && bandRectangles.size() == i - entryIndex);
+				bandRectangles.push_back(rect);
+				bandTypes.push_back(footer[i].preprocessingType);
+			}
+		}
 
-		ifs.read(reinterpret_cast<char*>(&startX), sizeof(startX));
-		if (startX == dataStartPos)break;
-		ifs.read(reinterpret_cast<char*>(&startY), sizeof(startY));
-		ifs.read(reinterpret_cast<char*>(&width), sizeof(width));
-		ifs.read(reinterpret_cast<char*>(&height), sizeof(height));
-		ifs.read(reinterpret_cast<char*>(&compressedSize), sizeof(compressedSize));
+		// sequences skipped by the bands of a damaged file are written with blank data
+		size_t firstRow = writtenRows;
+		size_t bandRows = writtenRows;
+		for (const auto& rect : bandRectangles) {
+			bandRows = std::max<size_t>(bandRows, static_cast<size_t>(rect->startX) + rect->width);
+		}
+		rowOffsets.assign(bandRows - firstRow, 0);
+		uint64_t bandSize = 0;
+		for (size_t row = firstRow; row < bandRows; ++row) {
+			rowOffsets[row - firstRow] = bandSize + idColumnSize(sequenceIds[row]);
+			bandSize += idColumnSize(sequenceIds[row]) + resultSize + NEWLINE_LENGTH;
+		}
+		band.resize(bandSize);
+		char* bandData = band.data();
+		for (size_t row = firstRow; row < bandRows; ++row) {
+			char* line = bandData + rowOffsets[row - firstRow];
+			writeIdColumn(line - idColumnSize(sequenceIds[row]), sequenceIds[row]);
+			std::memset(line, ' ', resultSize);
+			std::memcpy(line + resultSize, NEWLINE, NEWLINE_LENGTH);
+		}
 
-		footer.emplace_back(startX, startY, width, height, compressedSize);
-		if (startX == 0) {
-			resultSize += height;
+		// the rectangles of a tile group are decoded in order by one task, each against the previous one
+		pendingGroups.clear();
+		size_t groupStart = 0;
+		for (size_t i = 0; i < bandRectangles.size(); ++i) {
+			if (i + 1 < bandRectangles.size() && bandChained[i + 1]) {
+				continue;
+			}
+			std::vector<const Rectangle*> group;
+			std::vector<PreprocessingType> groupTypes;
+			for (size_t j = groupStart; j <= i; ++j) {
+				const Rectangle* rectPtr = bandRectangles[j].get();
+				if (static_cast<size_t>(rectPtr->startX) < firstRow) {
+					std::cerr << "Error: Rectangle at (" << rectPtr->startX << ", " << rectPtr->startY << ") overlaps a band already written." << std::endl;
+					continue;
+				}
+				group.push_back(rectPtr);
+				groupTypes.push_back(bandTypes[j]);
+			}
+			groupStart = i + 1;
+			pendingGroups.push_back(pool.submit([this, group, groupTypes, chained, bandData, firstRow, &rowOffsets]() {
+				std::vector<char> chain;
+				std::vector<char*> rows;
+				for (size_t j = 0; j < group.size(); ++j) {
+					const Rectangle* rectPtr = group[j];
+					rows.resize(rectPtr->width);
+					for (int row = 0; row < rectPtr->width; ++row) {
+						rows[row] = bandData + rowOffsets[rectPtr->startX + row - firstRow] + rectPtr->startY;
+					}
+					decodeRectangle(*rectPtr, groupTypes[j], rows.data(), chained ? &chain : NULL);
+				}
+			}));
+		}
+		for (auto& pending : pendingGroups) {
+			pending.get();
 		}
+
+		out->write(bandData, bandSize);
+		writtenRows = bandRows;
+		entryIndex = bandEnd;
 	}
 
-	std::ofstream ofs(outputFile);
-	if (!ofs) {
-		std::cerr << "Error: Unable to open output file: " << outputFile << std::endl;
+	std::string lines;
+	for (size_t row = writtenRows; row < sequenceIds.size(); ++row) {
+		lines.resize(idColumnSize(sequenceIds[row]));
+		writeIdColumn(&lines[0], sequenceIds[row]);
+		lines.append(resultSize, ' ');
+		lines.append(NEWLINE, NEWLINE_LENGTH);
+		out->write(lines.data(), lines.size());
+	}
+	out->flush();
+}
+
+/**
+ * Marks the rectangles to decompress: the chosen ones and, since the rectangles of a tile group are decoded in order,
+ * the ones before a chosen rectangle in its group.
+ */
+static std::vector<bool> rectanglesToDecompress(const std::vector<FooterEntry>& footer, const std::vector<bool>& chosen) {
+	std::vector<bool> decompressed(footer.size(), false);
+	for (size_t i = footer.size(); i-- > 0;) {
+		decompressed[i] = chosen[i] || (i + 1 < footer.size() && footer[i + 1].chained && decompressed[i + 1]);
+	}
+	return decompressed;
+}
+
+TileCache& MSACompressor::getTileCache() {
+	return tileCache;
+}
+
+void MSACompressor::openArchive(const std::string& inputFile, PreprocessingType preprocessingType, ArchiveIndex& archive) {
+	std::ifstream ifs(inputFile, std::ios::binary);
+	if (!ifs) {
+		std::cerr << "Error: Unable to open input file: " << inputFile << std::endl;
 		exit(1);
 	}
 
+	uint64_t sequenceIdsStartPos;
+	archive.path = inputFile;
+	archive.footer.clear();
+	readFooter(ifs, archive.dataStartPos, sequenceIdsStartPos, archive.footerStartPos, archive.footer, preprocessingType);
+	archive.columnCount = 0;
+	for (const auto& entry : archive.footer) {
+		if (entry.startX == 0) {
+			archive.columnCount += entry.height;
+		}
+	}
+
 	ifs.clear();
 	ifs.seekg(0);
-	while (ifs.tellg() < dataStartPos) {
+	archive.headers.clear();
+	while (ifs.tellg() < archive.dataStartPos) {
 		std::string header;
 		std::getline(ifs, header);
-		ofs << header << std::endl;
+		archive.headers.push_back(header);
 	}
 
-	std::vector<std::string> sequenceIds;
 	ifs.seekg(sequenceIdsStartPos, std::ios::beg);
-	std::streampos lineStartPos = ofs.tellp();
-	std::unordered_map<std::string, std::streampos> seqIdPositions;
-	int counter = 0;
-	std::vector<int> linenumbers;
-
-	while (ifs.tellg() < footerStartPos) {
+	archive.sequenceIds.clear();
+	archive.rowsById.clear();
+	while (ifs.tellg() < archive.footerStartPos) {
 		uint16_t idLength;
 		ifs.read(reinterpret_cast<char*>(&idLength), sizeof(idLength));
 		std::string id(idLength, ' ');
 		ifs.read(&id[0], idLength);
-		sequenceIds.push_back(id);
-		for (auto i : chosenSequenceIds)
-		{
-			if (id == i)
-			{
-				ofs << id << " ";
-				if (id.size() < 25) { ofs << std::string((25 - id.size()), ' '); }
-				seqIdPositions[id] = ofs.tellp();
-				ofs << std::string(resultSize, ' ');
-				ofs << std::endl;
-				linenumbers.push_back(counter);
-			}
-		}
-		counter++;
+		archive.rowsById.insert(std::make_pair(id, archive.sequenceIds.size()));
+		archive.sequenceIds.push_back(id);
 	}
+}
 
-	ofs.close();
-	ifs.close();
+void MSACompressor::decodeChosenRectangles(const ArchiveIndex& archive, const std::vector<int>& rowCounts, const std::function<void(size_t, const std::vector<Sequence>&)>& visit) {
+	const std::vector<FooterEntry>& footer = archive.footer;
 
-	std::fstream ofsUpdate(outputFile, std::ios::in | std::ios::out);
-	if (!ofsUpdate) {
-		std::cerr << "Error: Unable to open output file for updating: " << outputFile << std::endl;
-		exit(1);
+	std::ifstream ifs(archive.path, std::ios::binary);
+	if (!ifs) {
+		std::cerr << "Error: Unable to open input file: " << archive.path << std::endl;
+		return;
 	}
 
-	ifs.open(inputFile, std::ios::binary);
-	ifs.seekg(dataStartPos, std::ios::beg);
-
-	std::vector<std::tuple<int, int, int, int, uint64_t>> chosenFooter;
-	for (const auto& entry : footer) {
-		int startX, startY, width, height;
-		uint64_t compressedSize;
-		std::tie(startX, startY, width, height, compressedSize) = entry;
-		for (auto i : linenumbers)
-		{
-			if (startX <= i && startX + width > i) {
-				chosenFooter.push_back(entry);
-				break;
-			}
+	// A chosen duplicate takes the rows of the rectangle it repeats, which is decoded as deep as both need, unless
+	// the next rectangle of its group needs its whole frame. sources[i] is that rectangle, footer.size() for none.
+	std::vector<int> decodeRowCounts(rowCounts);
+	std::vector<size_t> sources(footer.size(), footer.size());
+	std::vector<bool> shared(footer.size(), false);
+	std::vector<bool> chosen(footer.size());
+	for (size_t index = 0; index < footer.size(); ++index) {
+		chosen[index] = rowCounts[index] > 0;
+	}
+	std::vector<bool> needed = rectanglesToDecompress(footer, chosen);
+	std::vector<char> reference;
+	for (size_t index = 0; index < footer.size(); ++index) {
+		const FooterEntry& entry = footer[index];
+		bool chainNeeded = index + 1 < footer.size() && footer[index + 1].chained && needed[index + 1];
+		if (!chosen[index] || entry.codec != DUPLICATE_CODEC || chainNeeded || entry.compressedSize != sizeof(uint32_t)) {
+			continue;
 		}
+		reference.resize(sizeof(uint32_t));
+		ifs.seekg(entry.offset, std::ios::beg);
+		ifs.read(reference.data(), reference.size());
+		uint32_t original;
+		if (!ifs || !findDuplicateSource(reference, footer, index, original)) {
+			// reported when the rectangle itself is read
+			ifs.clear();
+			continue;
+		}
+		sources[index] = original;
+		shared[original] = true;
+		decodeRowCounts[original] = std::max(decodeRowCounts[original], rowCounts[index]);
+		decodeRowCounts[index] = 0;
 	}
 
-	for (const auto& entry : footer) {
-		int startX, startY, width, height;
-		uint64_t compressedSize;
-		std::tie(startX, startY, width, height, compressedSize) = entry;
+	// rectangles cached with all the rows the query needs are not decoded again
+	bool cacheTiles = tileCache.enabled();
+	std::vector<TileRows> cachedRows(footer.size());
+	std::vector<bool> toDecode(footer.size());
+	for (size_t index = 0; index < footer.size(); ++index) {
+		toDecode[index] = decodeRowCounts[index] > 0;
+		if (cacheTiles && toDecode[index]) {
+			TileKey key = { archive.path, archive.footerStartPos, index };
+			cachedRows[index] = tileCache.find(key, decodeRowCounts[index]);
+			toDecode[index] = !cachedRows[index];
+		}
+	}
+	std::vector<bool> decompressed = rectanglesToDecompress(footer, toDecode);
+
+	std::vector<char> chain;
+	DecodeBuffer chainData;
+	std::vector<char>* rectChain = archiveTileGroupSize > 1 ? &chain : NULL;
+	uint64_t readPosition = 0;
+	ifs.seekg(0, std::ios::beg);
+	for (size_t index = 0; index < footer.size(); ++index) {
+		const FooterEntry& entry = footer[index];
+		if (sources[index] != footer.size()) {
+			if (cachedRows[sources[index]]) {
+				visit(index, *cachedRows[sources[index]]);
+			}
+			continue;
+		}
+		if (!decompressed[index]) {
+			if (cachedRows[index] && chosen[index]) {
+				visit(index, *cachedRows[index]);
+			}
+			continue;
+		}
 
 		Rectangle rect;
-		rect.startX = startX;
-		rect.startY = startY;
-		rect.width = width;
-		rect.height = height;
-		rect.compressedData.resize(compressedSize);
-
-		ifs.read(rect.compressedData.data(), compressedSize);
+		rect.startX = entry.startX;
+		rect.startY = entry.startY;
+		rect.width = entry.width;
+		rect.height = entry.height;
+		rect.codec = entry.codec;
+		rect.compressedData.resize(entry.compressedSize);
+
+		// rectangles following each other are read without seeking, so the stream buffer keeps serving them
+		if (readPosition != entry.offset) {
+			ifs.seekg(entry.offset, std::ios::beg);
+		}
+		ifs.read(rect.compressedData.data(), entry.compressedSize);
 		if (!ifs) {
 			std::cerr << "Error: Unable to read compressed data for rectangle at ("
-				<< startX << ", " << startY << "). Expected size: " << compressedSize << std::endl;
+				<< entry.startX << ", " << entry.startY << "). Expected size: " << entry.compressedSize << std::endl;
 			return;
 		}
+		readPosition = entry.offset + entry.compressedSize;
+
+		if (!entry.chained) {
+			chain.clear();
+		}
+		if (entry.codec == DUPLICATE_CODEC && !resolveDuplicate(ifs, footer, index, rect)) {
+			// the rows of an unresolved duplicate are blank, as the full decompression writes them
+			chain.clear();
+			if (chosen[index]) {
+				std::vector<Sequence> blank(std::max(entry.width, 0));
+				for (auto& seq : blank) {
+					seq.data.assign(std::max(entry.height, 0), ' ');
+				}
+				visit(index, blank);
+			}
+			continue;
+		}
+		if (decodeRowCounts[index] == 0) {
+			decompressRectangleData(rect, false, chainData, rectChain);
+			continue;
+		}
+
+		// decoding stops after the last chosen row unless the next rectangle of the group needs the whole frame
+		bool chainNeeded = index + 1 < footer.size() && footer[index + 1].chained && decompressed[index + 1];
+		if (chainNeeded) {
+			reversePreprocessing(rect, entry.preprocessingType, archive.sequenceIds, rectChain);
+		}
+		else {
+			reverseLeadingRows(rect, entry.preprocessingType, decodeRowCounts[index], archive.sequenceIds, rectChain);
+		}
 
+		TileRows rows = std::make_shared<const std::vector<Sequence>>(std::move(rect.sequences));
+		if (cacheTiles && rows->size() >= static_cast<size_t>(decodeRowCounts[index])) {
+			TileKey key = { archive.path, archive.footerStartPos, index };
+			tileCache.insert(key, rows);
+		}
+		if (shared[index]) {
+			cachedRows[index] = rows;
+		}
+		if (chosen[index]) {
+			visit(index, *rows);
+		}
+	}
+}
 
-		auto it = std::find(chosenFooter.begin(), chosenFooter.end(), entry);
-		if (it != chosenFooter.end()) {
+void MSACompressor::runQueries(const ArchiveIndex& archive, std::vector<ArchiveQuery>& queries) {
+	const std::vector<FooterEntry>& footer = archive.footer;
 
-			reversePreprocessing(rect, preprocessingType, sequenceIds);
-			for (const auto& seq : rect.sequences) {
-				for (auto i : chosenSequenceIds)
-				{
-					int inttt = 9;
-					if (seq.id == i)
-					{
-						auto pos = seqIdPositions[seq.id];
-						ofsUpdate.seekp(pos, std::ios::beg);
-						ofsUpdate << std::string(seq.data.begin(), seq.data.end());
-						std::streampos lenght = seq.data.size();
-						seqIdPositions[seq.id] = ofsUpdate.tellp();
+	// a band of rows is made of consecutive rectangles of the footer, band i starting at bandStarts[i]
+	std::vector<size_t> bandStarts;
+	for (size_t index = 0; index < footer.size(); ++index) {
+		if (index == 0 || footer[index].startX != footer[index - 1].startX) {
+			bandStarts.push_back(index);
+		}
+	}
+	bandStarts.push_back(footer.size());
+
+	// every rectangle is decoded once, up to the last row any query needs, and lists the queries it serves
+	std::vector<int> rowCounts(footer.size(), 0);
+	std::vector<std::vector<size_t>> rectangleQueries(footer.size());
+	std::vector<std::vector<std::pair<int, size_t>>> sortedColumns(queries.size());
+	for (size_t queryIndex = 0; queryIndex < queries.size(); ++queryIndex) {
+		ArchiveQuery& query = queries[queryIndex];
+		query.rows.clear();
+		if (query.columns) {
+			for (size_t row = 0; row < archive.sequenceIds.size(); ++row) {
+				query.rows.push_back(row);
+			}
+			// the chosen columns of a rectangle are a range of the columns sorted with their position in the query
+			std::vector<std::pair<int, size_t>>& columns = sortedColumns[queryIndex];
+			for (size_t position = 0; position < query.columnsIds.size(); ++position) {
+				columns.push_back(std::make_pair(query.columnsIds[position], position));
+			}
+			std::sort(columns.begin(), columns.end());
+			for (size_t index = 0; index < footer.size(); ++index) {
+				const FooterEntry& entry = footer[index];
+				auto first = std::lower_bound(columns.begin(), columns.end(), std::make_pair(entry.startY, size_t(0)));
+				if (first != columns.end() && first->first - entry.startY < entry.height) {
+					rowCounts[index] = entry.width;
+					rectangleQueries[index].push_back(queryIndex);
+				}
+			}
+		}
+		else {
+			for (const auto& id : query.sequenceIds) {
+				auto range = archive.rowsById.equal_range(id);
+				for (auto it = range.first; it != range.second; ++it) {
+					query.rows.push_back(it->second);
+				}
+			}
+			std::sort(query.rows.begin(), query.rows.end());
+			query.rows.erase(std::unique(query.rows.begin(), query.rows.end()), query.rows.end());
+			// the rectangles of a band crossing the range of columns hold its rows, the last chosen one bounding the rows to decode
+			for (size_t band = 0; band + 1 < bandStarts.size(); ++band) {
+				const FooterEntry& first = footer[bandStarts[band]];
+				auto end = std::lower_bound(query.rows.begin(), query.rows.end(), static_cast<size_t>(first.startX) + first.width);
+				if (end == query.rows.begin() || *(end - 1) < static_cast<size_t>(first.startX)) {
+					continue;
+				}
+				int rowCount = static_cast<int>(*(end - 1) - first.startX + 1);
+				for (size_t index = bandStarts[band]; index < bandStarts[band + 1]; ++index) {
+					const FooterEntry& entry = footer[index];
+					if (entry.startY > query.lastColumn || entry.startY + entry.height <= query.firstColumn) {
+						continue;
 					}
+					rowCounts[index] = std::max(rowCounts[index], rowCount);
+					rectangleQueries[index].push_back(queryIndex);
 				}
 			}
 		}
+		query.lines.assign(query.rows.size(), std::string());
 	}
 
-	ofsUpdate.close();
-	ifs.close();
+	std::vector<size_t> queryPositions;
+	decodeChosenRectangles(archive, rowCounts, [&](size_t index, const std::vector<Sequence>& tileRows) {
+		const FooterEntry& entry = footer[index];
+		for (size_t queryIndex : rectangleQueries[index]) {
+			ArchiveQuery& query = queries[queryIndex];
+			if (query.columns) {
+				// columns are written in the order of the query
+				const std::vector<std::pair<int, size_t>>& columns = sortedColumns[queryIndex];
+				auto first = std::lower_bound(columns.begin(), columns.end(), std::make_pair(entry.startY, size_t(0)));
+				auto last = std::lower_bound(first, columns.end(), std::make_pair(entry.startY + entry.height, size_t(0)));
+				queryPositions.clear();
+				for (auto column = first; column != last; ++column) {
+					queryPositions.push_back(column->second);
+				}
+				std::sort(queryPositions.begin(), queryPositions.end());
+
+				for (size_t row = 0; row < tileRows.size() && entry.startX + row < query.lines.size(); ++row) {
+					const Sequence& seq = tileRows[row];
+					std::string& line = query.lines[entry.startX + row];
+					// a short row of a damaged rectangle gets blanks for its missing symbols
+					for (size_t position : queryPositions) {
+						size_t symbol = static_cast<size_t>(query.columnsIds[position] - entry.startY);
+						line += symbol < seq.data.size() ? seq.data[symbol] : ' ';
+					}
+				}
+			}
+			else {
+				// the rectangles of a band come in the order of their columns, each adding its part of the range
+				size_t firstSymbol = static_cast<size_t>(std::max(query.firstColumn, entry.startY) - entry.startY);
+				size_t endSymbol = static_cast<size_t>(std::min(query.lastColumn - entry.startY, entry.height - 1)) + 1;
+				size_t line = std::lower_bound(query.rows.begin(), query.rows.end(), static_cast<size_t>(entry.startX)) - query.rows.begin();
+				for (; line < query.rows.size() && query.rows[line] - entry.startX < tileRows.size(); ++line) {
+					const std::vector<char>& data = tileRows[query.rows[line] - entry.startX].data;
+					size_t end = std::min(endSymbol, data.size());
+					if (firstSymbol < end) {
+						query.lines[line].append(data.begin() + firstSymbol, data.begin() + end);
+					}
+				}
+			}
+		}
+	});
 }
 
-void MSACompressor::decompressColumns(const std::string& inputFile, const std::string& outputFile, std::vector<int>& columnsIds, PreprocessingType preprocessingType) {
-	std::ifstream ifs(inputFile, std::ios::binary);
-	if (!ifs) {
-		std::cerr << "Error: Unable to open input file: " << inputFile << std::endl;
-		exit(1);
+// Appends a line of a query result: the sequence ID, padded as in a decompressed alignment, and the symbols padded with spaces to the given width.
+static void appendQueryLine(std::string& out, const std::string& id, const std::string& line, size_t width) {
+	out += id;
+	out += ' ';
+	if (id.size() < ID_COLUMN_WIDTH) {
+		out.append(ID_COLUMN_WIDTH - id.size(), ' ');
 	}
+	out += line;
+	if (line.size() < width) {
+		out.append(width - line.size(), ' ');
+	}
+	out += '\n';
+}
 
-	ifs.seekg(-static_cast<int>(3 * sizeof(uint64_t)), std::ios::end);
-	uint64_t dataStartPos, sequenceIdsStartPos, footerStartPos;
-	ifs.read(reinterpret_cast<char*>(&dataStartPos), sizeof(dataStartPos));
-	ifs.read(reinterpret_cast<char*>(&sequenceIdsStartPos), sizeof(sequenceIdsStartPos));
-	ifs.read(reinterpret_cast<char*>(&footerStartPos), sizeof(footerStartPos));
-
-	ifs.seekg(footerStartPos, std::ios::beg);
-	std::vector<std::tuple<int, int, int, int, uint64_t>> footer;
-	while (true) {
-		int startX, startY, width, height;
-		uint64_t compressedSize;
-
-		ifs.read(reinterpret_cast<char*>(&startX), sizeof(startX));
-		if (startX == dataStartPos)break;
-		ifs.read(reinterpret_cast<char*>(&startY), sizeof(startY));
-		ifs.read(reinterpret_cast<char*>(&width), sizeof(width));
-		ifs.read(reinterpret_cast<char*>(&height), sizeof(height));
-		ifs.read(reinterpret_cast<char*>(&compressedSize), sizeof(compressedSize));
-
-		footer.emplace_back(startX, startY, width, height, compressedSize);
+void MSACompressor::appendQueryResult(const ArchiveIndex& archive, const ArchiveQuery& query, bool headers, std::string& out) {
+	if (headers && !query.columns) {
+		for (const auto& header : archive.headers) {
+			out += header;
+			out += '\n';
+		}
+	}
+	// the column count of the Dc output keeps one more space than there are columns, sequences end with the range or the alignment
+	size_t width = query.columnsIds.size() + 1;
+	if (!query.columns) {
+		int lastColumn = std::min(query.lastColumn, archive.columnCount - 1);
+		width = lastColumn < query.firstColumn ? 0 : static_cast<size_t>(lastColumn - query.firstColumn + 1);
 	}
+	for (size_t i = 0; i < query.rows.size(); ++i) {
+		appendQueryLine(out, archive.sequenceIds[query.rows[i]], query.lines[i], width);
+	}
+}
 
+// Writes the result of a query to a file opened in text mode, like the output of the other modes.
+static void writeQueryOutput(const std::string& outputFile, const std::string& result) {
 	std::ofstream ofs(outputFile);
 	if (!ofs) {
 		std::cerr << "Error: Unable to open output file: " << outputFile << std::endl;
-		std::cerr << "Yol " << outputFile << std::endl;
-		return;
+		exit(1);
 	}
-	ifs.clear();
+	ofs << result;
+}
 
-	std::vector<std::string> sequenceIds;
-	ifs.seekg(sequenceIdsStartPos, std::ios::beg);
-	std::streampos lineStartPos = ofs.tellp();
-	std::unordered_map<std::string, std::streampos> seqIdPositions;
+void MSACompressor::decompressSequences(const std::string& inputFile, const std::string& outputFile, std::vector<std::string>& chosenSequenceIds, PreprocessingType preprocessingType) {
+	decompressSequenceRange(inputFile, outputFile, chosenSequenceIds, 0, INT_MAX, preprocessingType);
+}
 
-	while (ifs.tellg() < footerStartPos) {
-		uint16_t idLength;
-		ifs.read(reinterpret_cast<char*>(&idLength), sizeof(idLength));
-		std::string id(idLength, ' ');
-		ifs.read(&id[0], idLength);
-		sequenceIds.push_back(id);
-		ofs << id << " ";
-		if (id.size() < 25) { ofs << std::string((25 - id.size()), ' '); }
-		seqIdPositions[id] = ofs.tellp();
-		ofs << std::string(columnsIds.size() + 1, ' ');
-		ofs << std::endl;
-	}
+void MSACompressor::decompressSequenceRange(const std::string& inputFile, const std::string& outputFile, std::vector<std::string>& chosenSequenceIds, int firstColumn, int lastColumn, PreprocessingType preprocessingType) {
+	ArchiveIndex archive;
+	openArchive(inputFile, preprocessingType, archive);
+
+	std::vector<ArchiveQuery> queries(1);
+	queries[0].columns = false;
+	queries[0].sequenceIds = chosenSequenceIds;
+	queries[0].firstColumn = firstColumn;
+	queries[0].lastColumn = lastColumn;
+	runQueries(archive, queries);
+	std::string result;
+	appendQueryResult(archive, queries[0], true, result);
+	writeQueryOutput(outputFile, result);
+}
 
-	ofs.close();
-	ifs.close();
+void MSACompressor::decompressColumns(const std::string& inputFile, const std::string& outputFile, std::vector<int>& columnsIds, PreprocessingType preprocessingType) {
+	ArchiveIndex archive;
+	openArchive(inputFile, preprocessingType, archive);
+
+	std::vector<ArchiveQuery> queries(1);
+	queries[0].columns = true;
+	queries[0].columnsIds = columnsIds;
+	runQueries(archive, queries);
+	std::string result;
+	appendQueryResult(archive, queries[0], true, result);
+	writeQueryOutput(outputFile, result);
+}
 
-	std::fstream ofsUpdate(outputFile, std::ios::in | std::ios::out);
-	if (!ofsUpdate) {
-		std::cerr << "Error: Unable to open output file for updating: " << outputFile << std::endl;
-		return;
+bool MSACompressor::parseQuery(const std::string& mode, const std::vector<std::string>& arguments, ArchiveQuery& query) {
+	query.sequenceIds.clear();
+	query.columnsIds.clear();
+	query.firstColumn = 0;
+	query.lastColumn = INT_MAX;
+	if (mode == "Ds") {
+		query.columns = false;
+		query.sequenceIds = arguments;
+		return true;
 	}
-
-	ifs.open(inputFile, std::ios::binary);
-	ifs.seekg(dataStartPos, std::ios::beg);
-
-	std::vector<std::tuple<int, int, int, int, uint64_t>> chosenFooter;
-	for (const auto& entry : footer) {
-		int startX, startY, width, height;
-		uint64_t compressedSize;
-		std::tie(startX, startY, width, height, compressedSize) = entry;
-		for (auto i : columnsIds)
-		{
-			if (startY <= i && startY + height > i) {
-				chosenFooter.push_back(entry);
-				break;
-			}
+	if (mode == "Dsr" && arguments.size() >= 2) {
+		query.columns = false;
+		query.firstColumn = atoi(arguments[0].c_str());
+		query.lastColumn = atoi(arguments[1].c_str());
+		query.sequenceIds.assign(arguments.begin() + 2, arguments.end());
+		return true;
+	}
+	query.columns = true;
+	if (mode == "Dc") {
+		for (const auto& argument : arguments) {
+			query.columnsIds.push_back(atoi(argument.c_str()));
 		}
+		return true;
 	}
-
-	for (const auto& entry : footer) {
-		int startX, startY, width, height;
-		uint64_t compressedSize;
-		std::tie(startX, startY, width, height, compressedSize) = entry;
-
-		Rectangle rect;
-		rect.startX = startX;
-		rect.startY = startY;
-		rect.width = width;
-		rect.height = height;
-		rect.compressedData.resize(compressedSize);
-
-		ifs.read(rect.compressedData.data(), compressedSize);
-		if (!ifs) {
-			std::cerr << "Error: Unable to read compressed data for rectangle at ("
-				<< startX << ", " << startY << "). Expected size: " << compressedSize << std::endl;
-			return;
+	if (mode == "Drc" && arguments.size() == 2) {
+		int startId = atoi(arguments[0].c_str());
+		int stopId = atoi(arguments[1].c_str());
+		for (int i = startId; i < stopId + 1; i++) {
+			query.columnsIds.push_back(i);
 		}
+		return true;
+	}
+	return false;
+}
 
-		auto it = std::find(chosenFooter.begin(), chosenFooter.end(), entry);
-		if (it != chosenFooter.end()) {
-
-			reversePreprocessing(rect, preprocessingType, sequenceIds);
-
-			for (const auto& seq : rect.sequences) {
-
-				for (auto i : columnsIds)
-				{
-					auto pos = seqIdPositions[seq.id];
-					ofsUpdate.seekp(pos, std::ios::beg);
-					if (startY <= i && startY + height > i) {
-						ofsUpdate << seq.data[(i - startY)];
-						seqIdPositions[seq.id] = ofsUpdate.tellp();
+void MSACompressor::decompressBatch(const std::string& inputFile, const std::string& manifestFile, PreprocessingType preprocessingType) {
+	std::ifstream manifest(manifestFile);
+	if (!manifest) {
+		std::cerr << "Error: Unable to open query manifest: " << manifestFile << std::endl;
+		exit(1);
+	}
+	std::vector<ArchiveQuery> queries;
+	std::vector<std::string> outputFiles;
+	std::string line;
+	for (int lineNumber = 1; std::getline(manifest, line); ++lineNumber) {
+		std::istringstream iss(line);
+		std::string mode;
+		std::string outputFile;
+		if (!(iss >> mode) || mode[0] == '#') {
+			continue;
+		}
+		std::vector<std::string> arguments;
+		std::string argument;
+		iss >> outputFile;
+		while (iss >> argument) {
+			arguments.push_back(argument);
+		}
+		ArchiveQuery query;
+		if (outputFile.empty() || !parseQuery(mode, arguments, query)) {
+			std::cerr << "Error: Invalid query on line " << lineNumber << " of " << manifestFile << ": " << line << std::endl;
+			exit(1);
+		}
+		queries.push_back(query);
+		outputFiles.push_back(outputFile);
+	}
 
-					}
-				}
+	ArchiveIndex archive;
+	openArchive(inputFile, preprocessingType, archive);
+	runQueries(archive, queries);
 
-			}
+	// the results of the queries sharing an output file are written to it one after another
+	std::map<std::string, std::string> results;
+	std::vector<std::string> order;
+	for (size_t i = 0; i < queries.size(); ++i) {
+		if (results.find(outputFiles[i]) == results.end()) {
+			order.push_back(outputFiles[i]);
 		}
+		appendQueryResult(archive, queries[i], true, results[outputFiles[i]]);
+	}
+	for (const auto& outputFile : order) {
+		writeQueryOutput(outputFile, results[outputFile]);
 	}
-
-	ofsUpdate.close();
-	ifs.close();
 }
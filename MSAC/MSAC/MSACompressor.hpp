@@ -3,7 +3,18 @@
 
 #include <vector>
 #include <string>
+#include <fstream>
+#include <cstdint>
+#include <climits>
+#include <deque>
+#include <unordered_map>
+#include <future>
+#include <memory>
+#include <functional>
 #include "zstd.h"
+#include "ThreadPool.hpp"
+#include "ZstdContext.hpp"
+#include "TileCache.hpp"
 
 /**
  * Enumeration to define different types of preprocessing methods.
@@ -15,7 +26,21 @@ enum PreprocessingType {
     REDUCE_GAPS_B,                    // reducing gaps with method B
     REDUCE_GAPS_C,                    // reducing gaps with method C
     REDUCE_GAPS_AND_LOWERCASE,        // Reduce gaps with method A and convert to lowercase
-    REDUCE_GAPS_AND_UPPERCASE         // Reduce gaps with method A and convert to uppercase
+    REDUCE_GAPS_AND_UPPERCASE,        // Reduce gaps with method A and convert to uppercase
+    BWT_MTF,                          // Burrows-Wheeler transform and move-to-front of the whole rectangle, row by row
+    BWT_MTF_BY_COLUMN,                // Burrows-Wheeler transform and move-to-front of the whole rectangle, column by column
+    AUTO_PREPROCESSING                // Lossless method chosen separately for each rectangle by trial compression
+};
+
+/**
+ * Enumeration of the codecs encoding the serialized data of a rectangle, recorded for each rectangle.
+ */
+enum TileCodec {
+    ZSTD_CODEC,                       // Zstandard frame, including the frames of Huffman-coded literals only written by -H
+    STORED_CODEC,                     // Data stored as it is, used when no codec makes it smaller
+    CONSTANT_CODEC,                   // One pattern repeated, such as identical rows, stored once with its repetition count
+    FILL_CODEC,                       // Rectangle holding a single symbol (e.g. only gaps), stored as that symbol
+    DUPLICATE_CODEC                   // Same data as an earlier rectangle, stored as the index of its footer entry (4 bytes)
 };
 
 /**
@@ -35,7 +60,154 @@ struct Rectangle {
     int width;                              // Width of the rectangle
     int height;                             // Height of the rectangle
     std::vector<Sequence> sequences;        // List of sequences in this rectangle
+    std::vector<const char*> rows;          // Rows of the sequence band viewed by a rectangle being compressed, starting at column startY
     std::vector<char> compressedData;       // Compressed data for this rectangle
+    TileCodec codec;                        // Codec of the compressed data
+    bool prefixed;                          // Compressed against the previous rectangle of its tile group
+};
+
+/**
+ * Structure holding the serialized input of a rectangle being compressed.
+ * Every thread keeps one and reuses it for all rectangles it compresses.
+ */
+struct TileBuffer {
+    std::string data;                       // Preprocessed rectangle rows, each followed by '#'
+    std::vector<size_t> gapBounds;          // Start and end of every gap run in the row being encoded
+    std::vector<char> column;               // Column being encoded when the rectangle is serialized by columns
+};
+
+/**
+ * Structure holding the decoded data of a rectangle being decompressed.
+ * The storage is left uninitialized and only grows, so a thread reuses it for all rectangles it decodes.
+ */
+struct DecodeBuffer {
+    std::unique_ptr<char[]> data;           // Decoded rectangle data
+    size_t capacity;                        // Number of bytes allocated for data
+    size_t size;                            // Number of bytes of data in use
+
+    DecodeBuffer() : capacity(0), size(0) {}
+};
+
+/**
+ * Structure holding the settings of a compression.
+ */
+struct CompressionOptions {
+    int zstdLevel;                          // Compression level for Zstandard
+    int A;                                  // Number of rows in a rectangle
+    int B;                                  // Number of columns in a rectangle
+    PreprocessingType preprocessingType;    // Preprocessing of the rectangles
+    int threads;                            // Number of threads compressing rectangles
+    size_t dictionarySize;                  // Maximum size of the dictionary trained for the archive, 0 for none
+    bool verticalMatches;                   // Find matches with the vertical match producer instead of zstd's match finders
+    int windowLog;                          // Base-2 logarithm of the Zstandard window size, 0 to let the level choose
+    int strategy;                           // Zstandard match finding strategy, 0 to let the level choose
+    bool longDistanceMatching;              // Enables Zstandard long distance matching
+    bool literalsOnly;                      // Codes rectangles as Huffman-coded literals without matches, for the fastest decoding
+    int tileGroupSize;                      // Number of consecutive rectangles of a band compressed as a chain, each against the previous one
+};
+
+/**
+ * Structure holding the constraints of the tune mode, 0 for none.
+ */
+struct TuningConstraints {
+    double minCompressionSpeed;             // Minimum compression speed of one thread in MB/s
+    double maxSequenceLatency;              // Maximum time to decompress the rows of one sequence (Ds) in milliseconds
+    double maxMemory;                       // Maximum memory in MB used to compress or decompress
+};
+
+/**
+ * Structure holding the measurements of a configuration tried by the tune mode.
+ */
+struct TuningResult {
+    CompressionOptions options;             // Configuration measured
+    uint64_t compressedSize;                // Size of the compressed sample with its footer
+    double compressionSpeed;                // Compression speed of one thread in MB/s
+    double sequenceLatency;                 // Time of a Ds query of one sequence in milliseconds
+    double memory;                          // Estimated peak memory in MB of compression or decompression
+};
+
+/**
+ * Structure to represent a band of rows being compressed, kept until all its rectangles are written to the output.
+ */
+struct CompressionBand {
+    std::vector<Sequence> sequences;                        // Sequences of the band, viewed by its rectangles
+    std::vector<Rectangle> rectangles;                      // Rectangles of the band in output order
+    std::vector<PreprocessingType> types;                   // Preprocessing of each rectangle, set once it is compressed
+    std::vector<std::future<void>> results;                 // One per tile group of the band, ready once its rectangles are compressed
+};
+
+/**
+ * Structure holding the cells of a rectangle submitted for compression, which later identical rectangles refer to.
+ */
+struct PayloadCandidate {
+    uint32_t index;                         // Index of the footer entry of the rectangle
+    int width;                              // Width of the rectangle
+    int height;                             // Height of the rectangle
+    std::vector<char> cells;                // Rows of the rectangle, one after the other
+};
+
+/**
+ * Structure finding the rectangles already submitted for compression by a hash of their cells, so that identical ones
+ * are compressed and stored once. Candidates are kept in memory up to a budget, later rectangles are then only matched
+ * against them.
+ */
+struct PayloadIndex {
+    std::unordered_map<uint64_t, std::vector<PayloadCandidate>> entries;    // Rectangles that can be referenced, by hash of their cells
+    size_t candidateBytes;                                                  // Size of the cells of all candidates
+    size_t submitted;                                                       // Number of rectangles submitted, the footer index of the next one
+
+    PayloadIndex() : candidateBytes(0), submitted(0) {
+    }
+};
+
+/**
+ * Structure to represent one footer entry of the compressed file, describing a single compressed rectangle.
+ */
+struct FooterEntry {
+    int startX;                             // X-coordinate of the top-left corner
+    int startY;                             // Y-coordinate of the top-left corner
+    int width;                              // Width of the rectangle
+    int height;                             // Height of the rectangle
+    uint64_t compressedSize;                // Size of the compressed rectangle data
+    PreprocessingType preprocessingType;    // Preprocessing applied to this rectangle (stored as one byte)
+    TileCodec codec;                        // Codec of the compressed data (stored as one byte)
+    bool chained;                           // Compressed against the previous rectangle of its tile group (not stored, derived from the group size)
+    uint64_t offset;                        // Position of the compressed data in the file (not stored, derived from the sizes)
+
+    bool operator==(const FooterEntry& other) const {
+        return startX == other.startX && startY == other.startY && width == other.width && height == other.height
+            && compressedSize == other.compressedSize && preprocessingType == other.preprocessingType && codec == other.codec;
+    }
+};
+
+/**
+ * Structure holding what queries need from an opened archive, everything but the rectangle data.
+ * The dictionary and Zstandard parameters of the archive are held by the compressor that opened it, which must run its queries.
+ */
+struct ArchiveIndex {
+    std::string path;                                       // Path of the archive
+    std::vector<std::string> headers;                       // Lines preceding the alignment
+    std::vector<std::string> sequenceIds;                   // Identifier of every row
+    std::unordered_multimap<std::string, size_t> rowsById;  // Rows holding every identifier
+    std::vector<FooterEntry> footer;                        // Rectangles, in the order of their data
+    uint64_t dataStartPos;                                  // Position of the first rectangle
+    uint64_t footerStartPos;                                // Position of the footer
+    int columnCount;                                        // Number of columns of the alignment
+};
+
+/**
+ * Structure holding a query on sequences (Ds, Dsr) or columns (Dc, Drc) of an opened archive and its result.
+ */
+struct ArchiveQuery {
+    bool columns;                           // Whether columns are chosen rather than sequences
+    std::vector<std::string> sequenceIds;   // Chosen sequence IDs
+    int firstColumn;                        // First column of the chosen sequences
+    int lastColumn;                         // Last column of the chosen sequences, INT_MAX for the end of the rows
+    std::vector<int> columnsIds;            // Chosen columns, in the order of the result
+    std::vector<size_t> rows;               // Rows of the result in the order of the archive, all of them for columns
+    std::vector<std::string> lines;         // Chosen symbols of every row of the result
+
+    ArchiveQuery() : columns(false), firstColumn(0), lastColumn(INT_MAX) {}
 };
 
 /**
@@ -45,83 +217,145 @@ struct Rectangle {
 class MSACompressor {
 private:
     std::vector<Rectangle> rectangles;
+    std::string dictionaryLibraryFile;                  // Library of dictionaries shared by archives, empty for none
+    CompressionDictionary compressionDictionary;        // Dictionary of the archive being compressed, if any
+    DecompressionDictionary embeddedDictionary;         // Dictionary stored in the archive being decompressed, if any
+    const ZSTD_DDict* decompressionDictionary;          // Dictionary of the archive being decompressed, embedded or from the library, NULL for none
+    ZstdParameters archiveParameters;                   // Zstandard parameters recorded in the archive being decompressed
+    int archiveTileGroupSize;                           // Tile group size recorded in the archive being decompressed
+    TileCache tileCache;                                // Rectangles decoded by queries, kept for the following ones
 
     /**
-     * Applies preprocessing to a given rectangle based on the specified preprocessing type.
+     * Reverses the preprocessing previously applied to a given rectangle.
+     * The chain, if given, is used and updated as by decompressRectangleData.
      */
-    void applyPreprocessing(Rectangle& rect, PreprocessingType preprocessingType);
+    void reversePreprocessing(Rectangle& rect, PreprocessingType preprocessingType, const std::vector<std::string>& sequenceIds, std::vector<char>* chain = NULL);
 
     /**
-     * Reverses the preprocessing previously applied to a given rectangle.
+     * Reverses the preprocessing of a given rectangle up to its row rowCount - 1, for queries on its first rows.
+     * When the preprocessing keeps whole rows in order, the frame is streamed and decoding stops as soon as these rows
+     * are complete, the rectangle keeping only them; the chain, if given, is then only used and cleared, so no later
+     * rectangle of the tile group may be decoded from it. Otherwise the whole rectangle is decoded by reversePreprocessing.
+     */
+    void reverseLeadingRows(Rectangle& rect, PreprocessingType preprocessingType, int rowCount, const std::vector<std::string>& sequenceIds, std::vector<char>* chain = NULL);
+
+    /**
+     * Decompresses a given rectangle straight into the output, rows[i] receiving the symbols of row i of the rectangle.
+     * The chain, if given, is used and updated as by decompressRectangleData.
+     */
+    void decodeRectangle(const Rectangle& rect, PreprocessingType preprocessingType, char* const* rows, std::vector<char>* chain = NULL);
+
+    /**
+     * Decodes the data of a rectangle with its codec and reverses the Burrows-Wheeler transform if it was applied.
+     * A rectangle of a tile group is decompressed against the frame content of the previous one held in the chain,
+     * which is then replaced by its own frame content. An empty chain starts a group.
      */
-    void reversePreprocessing(Rectangle& rect, PreprocessingType preprocessingType, const std::vector<std::string>& sequenceIds);
+    bool decompressRectangleData(const Rectangle& rect, bool burrowsWheeler, DecodeBuffer& data, std::vector<char>* chain = NULL);
 
     /**
-     * Compresses a specific rectangle using Zstandard compression with a specified level and preprocessing.
+     * Compresses a specific rectangle using Zstandard compression with specified parameters and preprocessing.
+     * Rows or columns are passed to the compressor depending on the preprocessing type.
+     * A rectangle holding a single symbol is stored with the fill codec, ending the chain. Data made of a repeated pattern
+     * is stored with the constant codec and data no codec makes smaller is stored as it is.
+     * With a chain, the rectangle is compressed against the serialized previous rectangle of its tile group held in it,
+     * which is then replaced by the serialized data of this rectangle. An empty chain starts a group.
+     * A rectangle the Burrows-Wheeler transform fails on is compressed without preprocessing, which is set in preprocessingType.
      */
-    void compressRectangle(Rectangle& rect, int zstdLevel, PreprocessingType preprocessingType);
+    void compressRectangle(Rectangle& rect, const ZstdParameters& parameters, PreprocessingType& preprocessingType, std::string* chain = NULL);
 
     /**
-     * Compresses a specific rectangle using Zstandard compression with a specified level and preprocessing.
-     * Instead of rows, it passes data to the compressor by columns.
+     * Replaces the serialized rectangle data with its Burrows-Wheeler transform followed by move-to-front coding.
+     * The primary index of the transform is stored in the first four bytes of the result.
+     * Returns false, leaving the data unchanged, if the transform cannot be computed.
      */
-    void compressRectangleByColumn(Rectangle& rect, int zstdLevel, PreprocessingType preprocessingType);
+    bool burrowsWheelerTransform(std::string& rectData);
 
     /**
-     * Reduces gaps in a rectangle using the preprocessing method A.
+     * Restores serialized rectangle data transformed with burrowsWheelerTransform into a given buffer.
+     * Returns false if the primary index does not fit the data.
      */
-    void reduceGapsA(Rectangle& rect);
+    bool reverseBurrowsWheelerTransform(const char* transformedData, size_t size, DecodeBuffer& rectData);
 
     /**
-     * Reduces gaps in a rectangle using the preprocessing method B.
+     * Chooses the lossless preprocessing giving the smallest output for a rectangle.
+     * Candidates are trial-compressed on a sample of the rectangle rows, concurrently on the given pool or inline if it is NULL.
      */
-    void reduceGapsB(Rectangle& rect);
+    PreprocessingType choosePreprocessing(const Rectangle& rect, const ZstdParameters& parameters, ThreadPool* pool);
 
     /**
-     * Reduces gaps in a rectangle using the preprocessing method C.
+     * Moves the sequences into a new pending band and splits it into rectangles.
      */
-    void reduceGapsC(Rectangle& rect);
+    void queueBand(std::vector<Sequence>& sequences, int startX, const CompressionOptions& options, std::deque<CompressionBand>& pendingBands);
 
     /**
-     * Reverses the effect of preprocessing method A.
+     * Starts compressing the rectangles of a band, on the pool if several threads are requested and on the calling thread otherwise.
+     * The rectangles of a tile group are compressed in order by the same task. A rectangle compressed on its own whose cells,
+     * dimensions and preprocessing repeat an earlier one is not compressed but marked as its duplicate.
+     * Bands have to be submitted in output order.
      */
-    void reverseGapsA(Rectangle& rect, const std::vector<std::string>& sequenceIds);
+    void submitBand(CompressionBand& band, const CompressionOptions& options, ThreadPool& pool, PayloadIndex& payloads);
 
     /**
-     * Reverses the effect of preprocessing method B.
+     * Trains the dictionary of the archive on rows of the given bands and sets it up for compression.
+     * Returns false, leaving the dictionary empty, if there are too few samples.
      */
-    void reverseGapsB(Rectangle& rect, const std::vector<std::string>& sequenceIds);
+    bool trainDictionary(const std::deque<CompressionBand>& bands, const CompressionOptions& options, std::vector<char>& dictionary);
 
     /**
-     * Reverses the effect of preprocessing method C.
+     * Waits for the rectangles of a band in order, writes them to the output file and appends their footer entries and sequence IDs.
+     * A duplicate is written as the index of the rectangle it repeats, with the preprocessing chosen for that rectangle.
      */
-    void reverseGapsC(Rectangle& rect, const std::vector<std::string>& sequenceIds);
+    void writeBand(CompressionBand& band, std::ofstream& ofs, std::vector<std::string>& uniqueIds, std::vector<FooterEntry>& footer);
 
     /**
-     * Reduces gaps and converts the sequence data to uppercase in the given rectangle.
+     * Decodes the chosen rectangles of an opened archive and passes their index and rows to visit, in the order of the footer.
+     * Rectangle i is chosen when rowCounts[i] > 0 and only needs its rows up to rowCounts[i] - 1 decoded.
+     * Rectangles cached with enough rows are taken from the tile cache and the decoded ones are added to it.
+     * A duplicate is given the rows of the rectangle it repeats, decoded or cached once for both, with the IDs of that rectangle.
      */
-    void reduceGapsAndUpperCase(Rectangle& rect);
+    void decodeChosenRectangles(const ArchiveIndex& archive, const std::vector<int>& rowCounts, const std::function<void(size_t, const std::vector<Sequence>&)>& visit);
 
     /**
-     * Reduces gaps and converts the sequence data to lowercase in the given rectangle.
+     * Reads the trailer and the footer of a compressed file and loads its dictionary, if any.
+     * Files written before the preprocessing was recorded per rectangle use the given preprocessing type for all rectangles.
      */
-    void reduceGapsAndLowerCase(Rectangle& rect);
+    void readFooter(std::ifstream& ifs, uint64_t& dataStartPos, uint64_t& sequenceIdsStartPos, uint64_t& footerStartPos, std::vector<FooterEntry>& footer, PreprocessingType preprocessingType);
 
     /**
-     * Decompresses a given rectangle.
+     * Reads the compressed data of the rectangle described by a footer entry from the current position of the file.
+     * Returns false if the data cannot be read. A rectangle lying outside the alignment is reported and left empty.
      */
-    void decompressRectangle(Rectangle& rect, const std::vector<std::string>& sequenceIds);
+    bool readRectangle(std::ifstream& ifs, const std::vector<FooterEntry>& footer, size_t index, Rectangle& rect, size_t sequenceCount, uint64_t resultSize);
 
     /**
-     * Decompresses a given rectangle for data compressed with function compressRectangleByColumn.
+     * Replaces the data of a duplicate rectangle with the data and codec of the rectangle it refers to, read from the file
+     * without moving the current position. Returns false, reporting the error, if the reference is invalid.
      */
-    void decompressRectangleByColumn(Rectangle& rect, const std::vector<std::string>& sequenceIds);
+    bool resolveDuplicate(std::ifstream& ifs, const std::vector<FooterEntry>& footer, size_t index, Rectangle& rect);
+
+    /**
+     * Writes the decompressed alignment into a memory-mapped output file, decoding rectangles concurrently on the pool
+     * straight into their rows. Returns false without reading any rectangle if the file cannot be mapped.
+     */
+    bool writeMappedOutput(std::ifstream& ifs, const std::string& outputFile, const std::vector<FooterEntry>& footer, const std::vector<std::string>& headers, const std::vector<std::string>& sequenceIds, uint64_t resultSize, ThreadPool& pool);
+
+    /**
+     * Writes the decompressed alignment sequentially, one band of rows at a time, to a file or to the standard output ("-").
+     * The rectangles of a band are decoded concurrently on the pool into a buffer holding its complete lines.
+     */
+    void writeOutputByBands(std::ifstream& ifs, const std::string& outputFile, const std::vector<FooterEntry>& footer, const std::vector<std::string>& headers, const std::vector<std::string>& sequenceIds, uint64_t resultSize, ThreadPool& pool);
 
     /**
      * Splits the sequences into rectangles based on the provided dimensions.
+     * The rectangles view the rows of the sequences, which have to outlive them.
      */
     void splitSequencesIntoRectangles(const std::vector<Sequence>& sequences, int startX, std::vector<Rectangle>& rectangles, int A, int B);
 
+    /**
+     * Compresses a sample of rows with the given configuration on the calling thread and measures it.
+     */
+    TuningResult measureConfiguration(const std::vector<Sequence>& sample, const CompressionOptions& options);
+
 public:
 
     MSACompressor();
@@ -134,21 +368,86 @@ public:
     /**
      * Compresses the input file, saving the result to the output file.
      */
-    void compress(const std::string& inputFile, const std::string& outputFile, int zstdLevel, int A, int B, PreprocessingType preprocessingType);
+    void compress(const std::string& inputFile, const std::string& outputFile, const CompressionOptions& options);
+
+    /**
+     * Sets the dictionary library used by the following compressions and decompressions.
+     */
+    void setDictionaryLibrary(const std::string& libraryFile);
+
+    /**
+     * Builds a dictionary library from several alignments, training one dictionary for the families of each clan
+     * on rows split into rectangles as the compression options would.
+     */
+    void buildDictionaryLibrary(const std::string& libraryFile, const std::vector<std::string>& inputFiles, const CompressionOptions& options);
+
+    /**
+     * Searches the rectangle dimensions, compression level and preprocessing giving the smallest output on a sample of the input
+     * under the constraints, printing the configurations tried and the Pareto-optimal ones.
+     * The search starts from the given options and changes one setting at a time while the result improves.
+     * Unless the output file is "-", the input is then compressed to it with the configuration found.
+     */
+    void tune(const std::string& inputFile, const std::string& outputFile, const CompressionOptions& options, const TuningConstraints& constraints);
 
     /**
      * Decompresses the input file and saves the results to the output file.
+     * Rectangles are decoded concurrently by the given number of threads, each writing its rows straight into the mapped output file.
+     * With sequentialOutput, or when the output cannot be mapped (standard output, pipes), the output is written band by band.
+     */
+    void decompress(const std::string& inputFile, const std::string& outputFile, PreprocessingType preprocesingType, int threads, bool sequentialOutput);
+
+    /**
+     * Returns the cache of rectangles decoded by decompressSequences and decompressColumns, which is empty and disabled
+     * until it is given a capacity. Queries repeated on the same archive then reuse the rectangles already decoded.
+     */
+    TileCache& getTileCache();
+
+    /**
+     * Opens an archive for queries: reads its headers, sequence IDs and footer and loads its dictionary.
+     * The index then answers any number of queries run by this compressor without reading them again.
+     */
+    void openArchive(const std::string& inputFile, PreprocessingType preprocessingType, ArchiveIndex& archive);
+
+    /**
+     * Answers queries on an opened archive together, setting their rows and lines.
+     * Each rectangle any query needs is decoded once, up to the last row needed, and its rows are passed to all these queries.
+     * The rows of a query on sequences are the ones holding its IDs, each row once, and only the rectangles
+     * crossing its range of columns are decoded for it.
+     */
+    void runQueries(const ArchiveIndex& archive, std::vector<ArchiveQuery>& queries);
+
+    /**
+     * Sets a query from a query mode (Ds, Dsr, Dc or Drc) and its arguments as given on the command line.
+     * Returns false for an unknown mode or missing arguments.
+     */
+    static bool parseQuery(const std::string& mode, const std::vector<std::string>& arguments, ArchiveQuery& query);
+
+    /**
+     * Appends the result of a query as written by the matching mode, each line holding the sequence ID and the chosen symbols.
+     * With headers, the result of a query on sequences starts with the header lines of the alignment.
      */
-    void decompress(const std::string& inputFile, const std::string& outputFile, PreprocessingType preprocesingType);
+    static void appendQueryResult(const ArchiveIndex& archive, const ArchiveQuery& query, bool headers, std::string& out);
 
     /**
      * Decompresses selected sequences from the input file based on the provided sequence IDs.
      */
     void decompressSequences(const std::string& inputFile, const std::string& outputFile, std::vector<std::string>& chosenSequenceIds, PreprocessingType preprocessingType);
 
+    /**
+     * Decompresses the columns firstColumn to lastColumn of selected sequences, reading only the rectangles holding both.
+     */
+    void decompressSequenceRange(const std::string& inputFile, const std::string& outputFile, std::vector<std::string>& chosenSequenceIds, int firstColumn, int lastColumn, PreprocessingType preprocessingType);
+
     /**
      * Decompresses selected columns from the input file based on the provided column numbers.
      */
     void decompressColumns(const std::string& inputFile, const std::string& outputFile, std::vector<int>& columnsIds, PreprocessingType preprocessingType);
+
+    /**
+     * Answers the queries listed in a manifest file together, decoding every rectangle they need once.
+     * Each line of the manifest holds a query mode (Ds, Dsr, Dc or Drc), its output file and its arguments, separated by spaces;
+     * empty lines and lines starting with '#' are skipped. Queries sharing an output file write to it one after another.
+     */
+    void decompressBatch(const std::string& inputFile, const std::string& manifestFile, PreprocessingType preprocessingType);
 };
 #endif MSACOMPRESSOR_HPP
\ No newline at end of file
@@ -0,0 +1,104 @@
+﻿#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "MappedFile.hpp"
+
+#ifdef _WIN32
+
+MappedOutputFile::MappedOutputFile() : mappedData(NULL), mappedSize(0), fileHandle(INVALID_HANDLE_VALUE), mappingHandle(NULL) {
+}
+
+bool MappedOutputFile::open(const std::string& path, uint64_t size) {
+	close();
+	fileHandle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	mappedSize = size;
+	if (size == 0) {
+		return true;
+	}
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READWRITE, static_cast<DWORD>(size >> 32), static_cast<DWORD>(size & 0xFFFFFFFF), NULL);
+	if (mappingHandle == NULL) {
+		close();
+		return false;
+	}
+	mappedData = static_cast<char*>(MapViewOfFile(mappingHandle, FILE_MAP_WRITE, 0, 0, static_cast<SIZE_T>(size)));
+	if (mappedData == NULL) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedOutputFile::close() {
+	if (mappedData != NULL) {
+		UnmapViewOfFile(mappedData);
+		mappedData = NULL;
+	}
+	if (mappingHandle != NULL) {
+		CloseHandle(mappingHandle);
+		mappingHandle = NULL;
+	}
+	if (fileHandle != INVALID_HANDLE_VALUE) {
+		CloseHandle(fileHandle);
+		fileHandle = INVALID_HANDLE_VALUE;
+	}
+	mappedSize = 0;
+}
+
+#else
+
+MappedOutputFile::MappedOutputFile() : mappedData(NULL), mappedSize(0), fileDescriptor(-1) {
+}
+
+bool MappedOutputFile::open(const std::string& path, uint64_t size) {
+	close();
+	fileDescriptor = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fileDescriptor < 0) {
+		return false;
+	}
+	mappedSize = size;
+	if (size == 0) {
+		return true;
+	}
+	if (ftruncate(fileDescriptor, static_cast<off_t>(size)) != 0) {
+		close();
+		return false;
+	}
+	void* mapping = mmap(NULL, static_cast<size_t>(size), PROT_READ | PROT_WRITE, MAP_SHARED, fileDescriptor, 0);
+	if (mapping == MAP_FAILED) {
+		close();
+		return false;
+	}
+	mappedData = static_cast<char*>(mapping);
+	return true;
+}
+
+void MappedOutputFile::close() {
+	if (mappedData != NULL) {
+		munmap(mappedData, static_cast<size_t>(mappedSize));
+		mappedData = NULL;
+	}
+	if (fileDescriptor >= 0) {
+		::close(fileDescriptor);
+		fileDescriptor = -1;
+	}
+	mappedSize = 0;
+}
+
+#endif
+
+MappedOutputFile::~MappedOutputFile() {
+	close();
+}
+
+char* MappedOutputFile::data() {
+	return mappedData;
+}
@@ -0,0 +1,46 @@
+﻿#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <string>
+#include <cstdint>
+
+/**
+ * Output file of a known size mapped into memory, so that several threads can write disjoint byte ranges of it.
+ * Uses CreateFileMapping on Windows and mmap elsewhere.
+ */
+class MappedOutputFile {
+private:
+    char* mappedData;                       // Start of the mapped file, NULL when nothing is mapped
+    uint64_t mappedSize;                    // Size of the file
+#ifdef _WIN32
+    void* fileHandle;                       // Handle of the file
+    void* mappingHandle;                    // Handle of the file mapping object
+#else
+    int fileDescriptor;                     // Descriptor of the file
+#endif
+
+    MappedOutputFile(const MappedOutputFile&);
+    MappedOutputFile& operator=(const MappedOutputFile&);
+
+public:
+    MappedOutputFile();
+    ~MappedOutputFile();
+
+    /**
+     * Creates (or truncates) the file, resizes it to the given size and maps it for writing.
+     * Returns false if any of these steps fails.
+     */
+    bool open(const std::string& path, uint64_t size);
+
+    /**
+     * Returns the start of the mapped file.
+     */
+    char* data();
+
+    /**
+     * Unmaps and closes the file. Called by the destructor if needed.
+     */
+    void close();
+};
+
+#endif
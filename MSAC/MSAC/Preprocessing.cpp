@@ -0,0 +1,511 @@
+﻿#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include "GapScan.hpp"
+#include "Preprocessing.hpp"
+
+// Appends the decimal representation of a gap or residue count.
+static void appendCount(std::string& out, size_t count) {
+	char digits[20];
+	int length = 0;
+	do {
+		digits[length++] = static_cast<char>('0' + count % 10);
+		count /= 10;
+	} while (count != 0);
+	while (length > 0) {
+		out.push_back(digits[--length]);
+	}
+}
+
+// Adds a decimal digit to a count read from the archive. Counts saturate at INT_MAX, which no rectangle
+// side exceeds, so damaged digits cannot overflow; anything but a digit leaves the count unchanged.
+static size_t appendDigit(size_t value, char digit) {
+	size_t next = static_cast<unsigned char>(digit - '0');
+	if (next > 9) {
+		return value;
+	}
+	return value > (INT_MAX - next) / 10 ? INT_MAX : value * 10 + next;
+}
+
+// Parses the comma-separated counts stored in front of '@' by preprocessing methods B and C.
+static void parseCounts(const char* data, size_t begin, size_t end, std::vector<size_t>& counts) {
+	size_t value = 0;
+	bool hasValue = false;
+	for (size_t i = begin; i < end; ++i) {
+		if (data[i] == ',') {
+			counts.push_back(value);
+			value = 0;
+			hasValue = false;
+		}
+		else {
+			value = appendDigit(value, data[i]);
+			hasValue = true;
+		}
+	}
+	if (hasValue) {
+		counts.push_back(value);
+	}
+}
+
+// Stores the start and the end of every gap run of a row, so that preprocessing methods B and C can write
+// the counts in front of the residues without scanning the row twice.
+static void findGapRuns(const char* data, size_t size, std::vector<size_t>& gapBounds) {
+	gapBounds.clear();
+	size_t index = findGap(data, 0, size);
+	while (index < size) {
+		size_t gapEnd = skipGaps(data, index, size);
+		gapBounds.push_back(index);
+		gapBounds.push_back(gapEnd);
+		index = findGap(data, gapEnd, size);
+	}
+}
+
+// Returns the end of the counts of a row encoded with preprocessing method B or C, i.e. the position of '@'.
+static size_t findCountsEnd(const char* data, size_t begin, size_t size) {
+	const void* separator = std::memchr(data + begin, '@', size - begin);
+	return separator != NULL ? static_cast<const char*>(separator) - data : size;
+}
+
+// Case policies, applied to residues when a rectangle is serialized.
+
+struct KeepCase {
+	static const bool identity = true;
+	static char apply(char c) {
+		return c;
+	}
+};
+
+struct ToUpperCase {
+	static const bool identity = false;
+	static char apply(char c) {
+		return static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+	}
+};
+
+struct ToLowerCase {
+	static const bool identity = false;
+	static char apply(char c) {
+		return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+	}
+};
+
+template <class Case>
+static void appendResidues(const char* data, size_t count, std::string& out) {
+	if (Case::identity) {
+		out.append(data, count);
+		return;
+	}
+	for (size_t i = 0; i < count; ++i) {
+		out.push_back(Case::apply(data[i]));
+	}
+}
+
+// Appends the residues of a row, i.e. everything outside the gap runs found by findGapRuns.
+template <class Case>
+static void appendResiduesBetweenGaps(const char* data, size_t size, const std::vector<size_t>& gapBounds, std::string& out) {
+	size_t residuesStart = 0;
+	for (size_t i = 0; i < gapBounds.size(); i += 2) {
+		appendResidues<Case>(data + residuesStart, gapBounds[i] - residuesStart, out);
+		residuesStart = gapBounds[i + 1];
+	}
+	appendResidues<Case>(data + residuesStart, size - residuesStart, out);
+}
+
+// Output sinks of the gap decoders: a vector growing up to the length of the row, or a fixed row of the
+// output. Both ignore anything past the end of the row, so damaged counts can neither write outside the row
+// nor grow it without bound, and remember doing so, so that the rectangle is reported as damaged.
+
+struct VectorSink {
+	std::vector<char>& out;
+	size_t limit;
+	bool clipped;
+
+	VectorSink(std::vector<char>& out, size_t limit) : out(out), limit(limit), clipped(false) {
+	}
+
+	size_t clip(size_t count) {
+		size_t room = limit - std::min(out.size(), limit);
+		if (count > room) {
+			clipped = true;
+			return room;
+		}
+		return count;
+	}
+
+	void append(const char* data, size_t count) {
+		count = clip(count);
+		out.insert(out.end(), data, data + count);
+	}
+
+	void fill(size_t count, char c) {
+		count = clip(count);
+		out.insert(out.end(), count, c);
+	}
+};
+
+struct RowSink {
+	char* position;
+	char* end;
+	bool clipped;
+
+	RowSink(char* begin, size_t size) : position(begin), end(begin + size), clipped(false) {
+	}
+
+	size_t clip(size_t count) {
+		size_t room = end - position;
+		if (count > room) {
+			clipped = true;
+			return room;
+		}
+		return count;
+	}
+
+	void append(const char* data, size_t count) {
+		count = clip(count);
+		std::memcpy(position, data, count);
+		position += count;
+	}
+
+	void fill(size_t count, char c) {
+		count = clip(count);
+		std::memset(position, c, count);
+		position += count;
+	}
+};
+
+static void reportClippedRows(const Rectangle& rect) {
+	std::cerr << "Decompression error: Gap counts of the rectangle at " << rect.startX << "," << rect.startY
+		<< " exceed its size, its rows were cut." << std::endl;
+}
+
+// Gap encoding policies. encode appends one row to the buffer; decode reads one row starting at index
+// and leaves index at the row separator.
+
+struct KeepGaps {
+	template <class Case>
+	static void encode(const char* row, size_t size, TileBuffer& buffer) {
+		appendResidues<Case>(row, size, buffer.data);
+	}
+
+	template <class Sink>
+	static void decode(const char* data, size_t& index, size_t size, Sink& row, std::vector<size_t>&) {
+		const void* separator = std::memchr(data + index, '#', size - index);
+		size_t rowEnd = separator != NULL ? static_cast<const char*>(separator) - data : size;
+		row.append(data + index, rowEnd - index);
+		index = rowEnd;
+	}
+};
+
+// Method A: every gap run is replaced by its length written after the preceding residue.
+// A row starting with gaps keeps one '.' as that residue.
+struct GapsA {
+	template <class Case>
+	static void encode(const char* row, size_t size, TileBuffer& buffer) {
+		std::string& out = buffer.data;
+		size_t index = 0;
+
+		if (size > 0 && row[0] == '.') {
+			size_t gapEnd = skipGaps(row, 0, size);
+			out.push_back('.');
+			if (gapEnd > 1) {
+				appendCount(out, gapEnd - 1);
+			}
+			index = gapEnd;
+		}
+
+		while (index < size) {
+			size_t gapStart = findGap(row, index, size);
+			appendResidues<Case>(row + index, gapStart - index, out);
+			if (gapStart == size) {
+				break;
+			}
+			size_t gapEnd = skipGaps(row, gapStart, size);
+			appendCount(out, gapEnd - gapStart);
+			index = gapEnd;
+		}
+	}
+
+	template <class Sink>
+	static void decode(const char* data, size_t& index, size_t size, Sink& row, std::vector<size_t>&) {
+		while (index < size && data[index] != '#' && data[index] != '\0') {
+			size_t symbolsEnd = findCountOrRowEnd(data, index, size);
+			row.append(data + index, symbolsEnd - index);
+			index = symbolsEnd;
+
+			if (index < size && std::isdigit(static_cast<unsigned char>(data[index]))) {
+				size_t dotCount = 0;
+				while (index < size && std::isdigit(static_cast<unsigned char>(data[index]))) {
+					dotCount = appendDigit(dotCount, data[index]);
+					++index;
+				}
+				row.fill(dotCount, '.');
+			}
+		}
+	}
+};
+
+// Method B: "start,length" of every gap run, then '@' and the residues.
+struct GapsB {
+	template <class Case>
+	static void encode(const char* row, size_t size, TileBuffer& buffer) {
+		std::string& out = buffer.data;
+		findGapRuns(row, size, buffer.gapBounds);
+		const std::vector<size_t>& gapBounds = buffer.gapBounds;
+
+		for (size_t i = 0; i < gapBounds.size(); i += 2) {
+			appendCount(out, gapBounds[i]);
+			out.push_back(',');
+			appendCount(out, gapBounds[i + 1] - gapBounds[i]);
+			if (gapBounds[i + 1] < size) {
+				out.push_back(',');
+			}
+		}
+		out.push_back('@');
+		appendResiduesBetweenGaps<Case>(row, size, gapBounds, out);
+	}
+
+	template <class Sink>
+	static void decode(const char* data, size_t& index, size_t size, Sink& row, std::vector<size_t>& counts) {
+		size_t countsEnd = findCountsEnd(data, index, size);
+		counts.clear();
+		parseCounts(data, index, countsEnd, counts);
+		index = std::min(countsEnd + 1, size);
+
+		// residues contain no digits, so the first match is the row separator
+		size_t rowEnd = findCountOrRowEnd(data, index, size);
+		size_t rowIndex = 0;
+		for (size_t counter = 0; counter + 1 < counts.size(); counter += 2) {
+			// a damaged run may start before the end of the previous one
+			size_t residueCount = counts[counter] > rowIndex ? counts[counter] - rowIndex : 0;
+			size_t symbolCount = std::min<size_t>(residueCount, rowEnd - index);
+			row.append(data + index, symbolCount);
+			index += symbolCount;
+			row.fill(counts[counter + 1], '.');
+			rowIndex = counts[counter] + counts[counter + 1];
+		}
+		row.append(data + index, rowEnd - index);
+		index = rowEnd;
+	}
+};
+
+// Method C: alternating lengths of residue and gap runs, then '@' and the residues.
+struct GapsC {
+	template <class Case>
+	static void encode(const char* row, size_t size, TileBuffer& buffer) {
+		std::string& out = buffer.data;
+		findGapRuns(row, size, buffer.gapBounds);
+		const std::vector<size_t>& gapBounds = buffer.gapBounds;
+
+		size_t residuesStart = 0;
+		for (size_t i = 0; i < gapBounds.size(); i += 2) {
+			appendCount(out, gapBounds[i] - residuesStart);
+			out.push_back(',');
+			appendCount(out, gapBounds[i + 1] - gapBounds[i]);
+			residuesStart = gapBounds[i + 1];
+			if (residuesStart < size) {
+				out.push_back(',');
+			}
+		}
+		if (gapBounds.empty() || residuesStart < size) {
+			appendCount(out, size - residuesStart);
+			out.push_back(',');
+		}
+		out.push_back('@');
+		appendResiduesBetweenGaps<Case>(row, size, gapBounds, out);
+	}
+
+	template <class Sink>
+	static void decode(const char* data, size_t& index, size_t size, Sink& row, std::vector<size_t>& counts) {
+		size_t countsEnd = findCountsEnd(data, index, size);
+		counts.clear();
+		parseCounts(data, index, countsEnd, counts);
+		index = std::min(countsEnd + 1, size);
+
+		// residues contain no digits, so the first match is the row separator
+		size_t rowEnd = findCountOrRowEnd(data, index, size);
+		for (size_t counter = 0; counter < counts.size(); ++counter) {
+			if (counter % 2 == 0) {
+				size_t symbolCount = std::min<size_t>(counts[counter], rowEnd - index);
+				row.append(data + index, symbolCount);
+				index += symbolCount;
+			}
+			else {
+				row.fill(counts[counter], '.');
+			}
+		}
+		index = rowEnd;
+	}
+};
+
+// Layout policies, deciding whether rows or columns of the rectangle are encoded and separated by '#'.
+
+struct RowLayout {
+	static const bool rowMajor = true;
+
+	template <class Gaps, class Case>
+	static void serialize(const Rectangle& rect, TileBuffer& buffer) {
+		for (const char* row : rect.rows) {
+			Gaps::template encode<Case>(row, rect.height, buffer);
+			buffer.data += '#';
+		}
+	}
+
+	template <class Gaps>
+	static void deserialize(Rectangle& rect, const char* data, size_t size, const std::vector<std::string>& sequenceIds) {
+		std::vector<size_t> counts;
+		size_t index = 0;
+		bool clipped = false;
+		for (int row = 0; row < rect.width; ++row) {
+			Sequence seq;
+			seq.id = sequenceIds[rect.startX + row];
+			seq.data.reserve(rect.height);
+			VectorSink sink(seq.data, rect.height);
+			Gaps::decode(data, index, size, sink, counts);
+			clipped |= sink.clipped;
+			if (index < size && data[index] == '#') {
+				++index;
+			}
+			rect.sequences.push_back(std::move(seq));
+		}
+		if (clipped) {
+			reportClippedRows(rect);
+		}
+	}
+
+	template <class Gaps>
+	static void decodeRows(const Rectangle& rect, const char* data, size_t size, char* const* rows) {
+		std::vector<size_t> counts;
+		size_t index = 0;
+		bool clipped = false;
+		for (int row = 0; row < rect.width; ++row) {
+			RowSink sink(rows[row], rect.height);
+			Gaps::decode(data, index, size, sink, counts);
+			clipped |= sink.clipped;
+			sink.fill(sink.end - sink.position, ' ');
+			if (index < size && data[index] == '#') {
+				++index;
+			}
+		}
+		if (clipped) {
+			reportClippedRows(rect);
+		}
+	}
+};
+
+struct ColumnLayout {
+	static const bool rowMajor = false;
+
+	template <class Gaps, class Case>
+	static void serialize(const Rectangle& rect, TileBuffer& buffer) {
+		buffer.column.resize(rect.width);
+		for (int i = 0; i < rect.height; ++i) {
+			for (int row = 0; row < rect.width; ++row) {
+				buffer.column[row] = rect.rows[row][i];
+			}
+			Gaps::template encode<Case>(buffer.column.data(), buffer.column.size(), buffer);
+			buffer.data += '#';
+		}
+	}
+
+	template <class Gaps>
+	static void deserialize(Rectangle& rect, const char* data, size_t size, const std::vector<std::string>& sequenceIds) {
+		std::vector<size_t> counts;
+		std::vector<char> column;
+		size_t index = 0;
+		bool clipped = false;
+		for (int row = 0; row < rect.width; ++row) {
+			Sequence seq;
+			seq.id = sequenceIds[rect.startX + row];
+			seq.data.reserve(rect.height);
+			rect.sequences.push_back(std::move(seq));
+		}
+		for (int i = 0; i < rect.height; ++i) {
+			column.clear();
+			VectorSink sink(column, rect.width);
+			Gaps::decode(data, index, size, sink, counts);
+			clipped |= sink.clipped;
+			size_t rows = std::min(column.size(), rect.sequences.size());
+			for (size_t row = 0; row < rows; ++row) {
+				rect.sequences[row].data.push_back(column[row]);
+			}
+			if (index < size && data[index] == '#') {
+				++index;
+			}
+		}
+		if (clipped) {
+			reportClippedRows(rect);
+		}
+	}
+
+	template <class Gaps>
+	static void decodeRows(const Rectangle& rect, const char* data, size_t size, char* const* rows) {
+		std::vector<size_t> counts;
+		std::vector<char> column;
+		size_t index = 0;
+		bool clipped = false;
+		for (int i = 0; i < rect.height; ++i) {
+			column.clear();
+			VectorSink sink(column, rect.width);
+			Gaps::decode(data, index, size, sink, counts);
+			clipped |= sink.clipped;
+			for (size_t row = 0; row < static_cast<size_t>(rect.width); ++row) {
+				rows[row][i] = row < column.size() ? column[row] : ' ';
+			}
+			if (index < size && data[index] == '#') {
+				++index;
+			}
+		}
+		if (clipped) {
+			reportClippedRows(rect);
+		}
+	}
+};
+
+template <class Layout, class Gaps, class Case>
+struct ComposedKernels {
+	static void serialize(const Rectangle& rect, TileBuffer& buffer) {
+		Layout::template serialize<Gaps, Case>(rect, buffer);
+	}
+
+	static void deserialize(Rectangle& rect, const char* data, size_t size, const std::vector<std::string>& sequenceIds) {
+		Layout::template deserialize<Gaps>(rect, data, size, sequenceIds);
+	}
+
+	static void decodeRows(const Rectangle& rect, const char* data, size_t size, char* const* rows) {
+		Layout::template decodeRows<Gaps>(rect, data, size, rows);
+	}
+};
+
+template <class Layout, class Gaps, class Case>
+static PreprocessingKernels composeKernels(bool burrowsWheeler) {
+	PreprocessingKernels kernels = {
+		&ComposedKernels<Layout, Gaps, Case>::serialize,
+		&ComposedKernels<Layout, Gaps, Case>::deserialize,
+		&ComposedKernels<Layout, Gaps, Case>::decodeRows,
+		burrowsWheeler,
+		Layout::rowMajor && !burrowsWheeler
+	};
+	return kernels;
+}
+
+// Indexed by PreprocessingType
+static const PreprocessingKernels kernelTable[] = {
+	composeKernels<RowLayout, KeepGaps, KeepCase>(false),           // NO_PREPROCESSING
+	composeKernels<RowLayout, GapsA, KeepCase>(false),              // REDUCE_GAPS_A
+	composeKernels<RowLayout, GapsB, KeepCase>(false),              // REDUCE_GAPS_B
+	composeKernels<RowLayout, GapsC, KeepCase>(false),              // REDUCE_GAPS_C
+	composeKernels<RowLayout, GapsA, ToLowerCase>(false),           // REDUCE_GAPS_AND_LOWERCASE
+	composeKernels<RowLayout, GapsA, ToUpperCase>(false),           // REDUCE_GAPS_AND_UPPERCASE
+	composeKernels<RowLayout, KeepGaps, KeepCase>(true),            // BWT_MTF
+	composeKernels<ColumnLayout, KeepGaps, KeepCase>(true)          // BWT_MTF_BY_COLUMN
+};
+
+const PreprocessingKernels* findPreprocessingKernels(PreprocessingType preprocessingType) {
+	size_t index = static_cast<size_t>(preprocessingType);
+	if (index >= sizeof(kernelTable) / sizeof(kernelTable[0])) {
+		return NULL;
+	}
+	return &kernelTable[index];
+}
@@ -0,0 +1,37 @@
+﻿#ifndef PREPROCESSING_HPP
+#define PREPROCESSING_HPP
+
+#include <vector>
+#include <string>
+#include "MSACompressor.hpp"
+
+/**
+ * Serialization and deserialization kernels of one preprocessing type.
+ * Every kernel is a template instantiation composing a layout (rows or columns), a gap encoding
+ * (kept, method A, B or C) and a case conversion, so no decision on the mode is made per character.
+ */
+struct PreprocessingKernels {
+    /**
+     * Appends the preprocessed rectangle to the buffer, each row (or column) followed by '#'.
+     */
+    void (*serialize)(const Rectangle& rect, TileBuffer& buffer);
+    /**
+     * Rebuilds the sequences of a rectangle from the data written by serialize.
+     */
+    void (*deserialize)(Rectangle& rect, const char* data, size_t size, const std::vector<std::string>& sequenceIds);
+    /**
+     * Decodes the data written by serialize straight into the output, rows[i] receiving the rect.height symbols of row i.
+     * Rows left incomplete by damaged data are padded with spaces.
+     */
+    void (*decodeRows)(const Rectangle& rect, const char* data, size_t size, char* const* rows);
+    bool burrowsWheeler;                    // Serialized data is further transformed with BWT and move-to-front
+    bool leadingRows;                       // The first rows can be deserialized from the start of the data alone
+};
+
+/**
+ * Returns the kernels of the given preprocessing type, or NULL if it has none (e.g. AUTO_PREPROCESSING
+ * or an unknown value read from a damaged file).
+ */
+const PreprocessingKernels* findPreprocessingKernels(PreprocessingType preprocessingType);
+
+#endif
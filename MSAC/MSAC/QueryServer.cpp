@@ -0,0 +1,268 @@
+﻿#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <csignal>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <exception>
+#include <thread>
+#include <system_error>
+#include "ThreadPool.hpp"
+#include "QueryServer.hpp"
+
+#ifdef _WIN32
+typedef SOCKET SocketHandle;
+static const SocketHandle INVALID_SOCKET_HANDLE = INVALID_SOCKET;
+
+static void closeSocket(SocketHandle socket) {
+	closesocket(socket);
+}
+
+// Removes the socket left at path by a previous server, returning false if something else is there.
+static bool removeStaleSocket(const std::string& path) {
+	DWORD attributes = GetFileAttributesA(path.c_str());
+	if (attributes == INVALID_FILE_ATTRIBUTES) {
+		return GetLastError() == ERROR_FILE_NOT_FOUND || GetLastError() == ERROR_PATH_NOT_FOUND;
+	}
+	// a Unix domain socket is a reparse point
+	if ((attributes & FILE_ATTRIBUTE_REPARSE_POINT) == 0 || (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0) {
+		return false;
+	}
+	return DeleteFileA(path.c_str()) != 0;
+}
+#else
+typedef int SocketHandle;
+static const SocketHandle INVALID_SOCKET_HANDLE = -1;
+
+static void closeSocket(SocketHandle socket) {
+	close(socket);
+}
+
+// Removes the socket left at path by a previous server, returning false if something else is there.
+static bool removeStaleSocket(const std::string& path) {
+	struct stat info;
+	if (lstat(path.c_str(), &info) != 0) {
+		return errno == ENOENT;
+	}
+	if (!S_ISSOCK(info.st_mode)) {
+		return false;
+	}
+	return unlink(path.c_str()) == 0 || errno == ENOENT;
+}
+#endif
+
+// Largest request accepted, so that a damaged length does not exhaust the memory
+static const uint32_t MAX_REQUEST_SIZE = 64 * 1024 * 1024;
+
+// Status byte starting a response
+static const char STATUS_OK = 0;
+static const char STATUS_ERROR = 1;
+
+// Receives exactly size bytes, returning false if the connection is closed or fails first.
+static bool receiveFully(SocketHandle socket, char* data, size_t size) {
+	while (size > 0) {
+		int chunk = static_cast<int>(std::min<size_t>(size, 1 << 30));
+		int received = static_cast<int>(recv(socket, data, chunk, 0));
+		if (received <= 0) {
+#ifndef _WIN32
+			if (received < 0 && errno == EINTR) {
+				continue;
+			}
+#endif
+			return false;
+		}
+		data += received;
+		size -= received;
+	}
+	return true;
+}
+
+// Sends exactly size bytes, returning false if the connection fails first.
+static bool sendFully(SocketHandle socket, const char* data, size_t size) {
+	while (size > 0) {
+		int chunk = static_cast<int>(std::min<size_t>(size, 1 << 30));
+		int sent = static_cast<int>(send(socket, data, chunk, 0));
+		if (sent <= 0) {
+#ifndef _WIN32
+			if (sent < 0 && errno == EINTR) {
+				continue;
+			}
+#endif
+			return false;
+		}
+		data += sent;
+		size -= sent;
+	}
+	return true;
+}
+
+// Encodes a 32-bit length in little-endian order, whatever the byte order of the machine.
+static void encodeLength(uint32_t length, char* out) {
+	for (int i = 0; i < 4; ++i) {
+		out[i] = static_cast<char>((length >> (8 * i)) & 0xFF);
+	}
+}
+
+static uint32_t decodeLength(const char* in) {
+	uint32_t length = 0;
+	for (int i = 0; i < 4; ++i) {
+		length |= static_cast<uint32_t>(static_cast<unsigned char>(in[i])) << (8 * i);
+	}
+	return length;
+}
+
+QueryServer::QueryServer(const std::vector<std::string>& archiveFiles, PreprocessingType preprocessingType, size_t cacheSize) {
+	for (const auto& archiveFile : archiveFiles) {
+		std::unique_ptr<Archive> archive(new Archive());
+		archive->compressor.getTileCache().setCapacity(cacheSize);
+		archive->compressor.openArchive(archiveFile, preprocessingType, archive->index);
+		archives[archiveFile] = std::move(archive);
+	}
+}
+
+bool QueryServer::answer(const std::string& request, std::string& result) {
+	std::vector<std::string> lines;
+	std::istringstream iss(request);
+	std::string line;
+	while (std::getline(iss, line)) {
+		lines.push_back(line);
+	}
+	result.clear();
+
+	if (!lines.empty() && lines[0] == "stats") {
+		for (const auto& archive : archives) {
+			const TileCache& cache = archive.second->compressor.getTileCache();
+			result += archive.first + " hits " + std::to_string(cache.hitCount()) + " misses " + std::to_string(cache.missCount()) + "\n";
+		}
+		return true;
+	}
+	if (lines.size() < 2) {
+		result = "Error: A request needs a query and an archive.\n";
+		return false;
+	}
+	auto it = archives.find(lines[1]);
+	if (it == archives.end()) {
+		result = "Error: Unknown archive: " + lines[1] + "\n";
+		return false;
+	}
+	std::vector<std::string> arguments(lines.begin() + 2, lines.end());
+	std::vector<ArchiveQuery> queries(1);
+	if (!MSACompressor::parseQuery(lines[0], arguments, queries[0])) {
+		result = "Error: Invalid query: " + lines[0] + "\n";
+		return false;
+	}
+	it->second->compressor.runQueries(it->second->index, queries);
+	MSACompressor::appendQueryResult(it->second->index, queries[0], false, result);
+	return true;
+}
+
+void QueryServer::serveConnection(intptr_t connection, ThreadPool& pool) {
+	SocketHandle socket = static_cast<SocketHandle>(connection);
+	char length[4];
+	std::string request;
+	std::string result;
+	while (receiveFully(socket, length, sizeof(length))) {
+		uint32_t requestSize = decodeLength(length);
+		if (requestSize > MAX_REQUEST_SIZE) {
+			std::cerr << "Error: Request of " << requestSize << " bytes refused." << std::endl;
+			break;
+		}
+		request.resize(requestSize);
+		if (requestSize > 0 && !receiveFully(socket, &request[0], requestSize)) {
+			break;
+		}
+		bool answered;
+		try {
+			answered = pool.submit([this, &request, &result]() { return answer(request, result); }).get();
+		}
+		catch (const std::exception& e) {
+			// the exception of a failed query would otherwise terminate the server from this detached thread
+			answered = false;
+			result = std::string("Error: The query failed: ") + e.what() + "\n";
+		}
+		catch (...) {
+			answered = false;
+			result = "Error: The query failed.\n";
+		}
+		if (result.size() + 1 > UINT32_MAX) {
+			answered = false;
+			result = "Error: The result exceeds the largest response.\n";
+		}
+		char header[5];
+		encodeLength(static_cast<uint32_t>(result.size() + 1), header);
+		header[4] = answered ? STATUS_OK : STATUS_ERROR;
+		if (!sendFully(socket, header, sizeof(header)) || !sendFully(socket, result.data(), result.size())) {
+			break;
+		}
+	}
+	closeSocket(socket);
+}
+
+void QueryServer::serve(const std::string& socketPath, int threads) {
+#ifdef _WIN32
+	WSADATA winsockData;
+	if (WSAStartup(MAKEWORD(2, 2), &winsockData) != 0) {
+		std::cerr << "Error: Unable to initialize Winsock." << std::endl;
+		return;
+	}
+#else
+	// a client closing its connection early must not terminate the server
+	std::signal(SIGPIPE, SIG_IGN);
+#endif
+
+	sockaddr_un address;
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(address.sun_path)) {
+		std::cerr << "Error: Socket path too long: " << socketPath << std::endl;
+		return;
+	}
+	std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+	SocketHandle listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener == INVALID_SOCKET_HANDLE) {
+		std::cerr << "Error: Unable to create a socket." << std::endl;
+		return;
+	}
+	if (!removeStaleSocket(socketPath)) {
+		std::cerr << "Error: Unable to replace " << socketPath << ", which exists and is not a socket." << std::endl;
+		closeSocket(listener);
+		return;
+	}
+	if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+		std::cerr << "Error: Unable to listen on socket: " << socketPath << std::endl;
+		closeSocket(listener);
+		return;
+	}
+	std::cerr << "Serving " << archives.size() << " archive(s) on " << socketPath << std::endl;
+
+	ThreadPool pool(threads);
+	while (true) {
+		SocketHandle connection = accept(listener, NULL, NULL);
+		if (connection == INVALID_SOCKET_HANDLE) {
+			continue;
+		}
+		// an idle client only holds its own thread, so it never keeps the pool from answering the others
+		intptr_t handle = static_cast<intptr_t>(connection);
+		try {
+			std::thread(&QueryServer::serveConnection, this, handle, std::ref(pool)).detach();
+		}
+		catch (const std::system_error&) {
+			std::cerr << "Error: Unable to start a thread for a connection." << std::endl;
+			closeSocket(connection);
+		}
+	}
+}
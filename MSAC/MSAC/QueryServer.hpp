@@ -0,0 +1,61 @@
+﻿#ifndef QUERYSERVER_HPP
+#define QUERYSERVER_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <cstdint>
+#include "MSACompressor.hpp"
+
+/**
+ * Answers queries on a set of archives kept open, received over a Unix domain socket.
+ * Every archive is opened once by its own compressor, so its index, dictionary and decoded rectangles stay in memory.
+ *
+ * Requests and responses are messages made of a 32-bit little-endian length followed by that many bytes, and a
+ * connection may send any number of requests, each answered before the next one is read.
+ * A request holds lines separated by '\n': the query (Ds, Dsr, Dc, Drc or stats), the archive as named when the server
+ * was started, then one argument per line as given to the matching command.
+ * A response holds a status byte, 0 for success and 1 for an error, followed by the lines the matching command writes
+ * (without the headers of the alignment) or by an error message.
+ */
+class QueryServer {
+private:
+    struct Archive {
+        MSACompressor compressor;           // Compressor holding the dictionary, parameters and decoded rectangles of the archive
+        ArchiveIndex index;                 // Index of the archive
+    };
+
+    std::map<std::string, std::unique_ptr<Archive>> archives;  // Opened archives, by the name given when the server was started
+
+    /**
+     * Reads the requests received over a connection until the client closes it, answering each one on the pool.
+     */
+    void serveConnection(intptr_t connection, ThreadPool& pool);
+
+public:
+
+    /**
+     * Opens the given archives, giving each a tile cache of cacheSize bytes.
+     * Archives written before the preprocessing was recorded per rectangle use the given preprocessing type.
+     */
+    QueryServer(const std::vector<std::string>& archiveFiles, PreprocessingType preprocessingType, size_t cacheSize);
+
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+    /**
+     * Answers a request, writing the response body to result. Returns false, with an error message in result,
+     * if the request is malformed or names an unknown archive.
+     */
+    bool answer(const std::string& request, std::string& result);
+
+    /**
+     * Listens on a Unix domain socket created at the given path, replacing any file there. Every connection is read
+     * by a thread of its own, which waits while the client is idle, and the requests of all the connections are
+     * answered on a pool of the given number of threads. Never returns unless the socket cannot be set up.
+     */
+    void serve(const std::string& socketPath, int threads);
+};
+
+#endif
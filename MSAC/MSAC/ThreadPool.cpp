@@ -0,0 +1,42 @@
+﻿#include "ThreadPool.hpp"
+
+
+ThreadPool::ThreadPool(unsigned int threadCount) : stopping(false) {
+	if (threadCount < 1) {
+		threadCount = 1;
+	}
+	for (unsigned int i = 0; i < threadCount; ++i) {
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(tasksMutex);
+		stopping = true;
+	}
+	tasksAvailable.notify_all();
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+unsigned int ThreadPool::size() const {
+	return static_cast<unsigned int>(workers.size());
+}
+
+void ThreadPool::workerLoop() {
+	while (true) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(tasksMutex);
+			tasksAvailable.wait(lock, [this]() { return stopping || !tasks.empty(); });
+			if (tasks.empty()) {
+				return;
+			}
+			task = std::move(tasks.front());
+			tasks.pop();
+		}
+		task();
+	}
+}
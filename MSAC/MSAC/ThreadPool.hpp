@@ -0,0 +1,64 @@
+﻿#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+/**
+ * Fixed-size pool of worker threads executing submitted tasks in FIFO order.
+ */
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;              // Worker threads owned by the pool
+    std::queue<std::function<void()>> tasks;       // Tasks waiting for a free worker
+    std::mutex tasksMutex;                         // Guards tasks and stopping
+    std::condition_variable tasksAvailable;        // Signalled when a task is queued or the pool is stopping
+    bool stopping;                                 // Set when the pool is being destroyed
+
+    /**
+     * Main loop of a worker thread: takes tasks from the queue until the pool is stopped.
+     */
+    void workerLoop();
+
+public:
+
+    /**
+     * Starts the given number of worker threads (at least one).
+     */
+    explicit ThreadPool(unsigned int threadCount);
+
+    /**
+     * Finishes all queued tasks and joins the worker threads.
+     */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /**
+     * Returns the number of worker threads.
+     */
+    unsigned int size() const;
+
+    /**
+     * Queues a task and returns a future holding its result.
+     */
+    template <typename Task>
+    auto submit(Task task) -> std::future<decltype(task())> {
+        auto packagedTask = std::make_shared<std::packaged_task<decltype(task())()>>(std::move(task));
+        std::future<decltype(task())> result = packagedTask->get_future();
+        {
+            std::lock_guard<std::mutex> lock(tasksMutex);
+            tasks.emplace([packagedTask]() { (*packagedTask)(); });
+        }
+        tasksAvailable.notify_one();
+        return result;
+    }
+};
+#endif
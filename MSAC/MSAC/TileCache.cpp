@@ -0,0 +1,82 @@
+﻿#include "MSACompressor.hpp"
+#include "TileCache.hpp"
+
+
+size_t TileKeyHash::operator()(const TileKey& key) const {
+	size_t hash = std::hash<std::string>()(key.archive);
+	hash ^= std::hash<uint64_t>()(key.footerStart) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+	hash ^= std::hash<size_t>()(key.index) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+	return hash;
+}
+
+// Bytes held by decoded rows, including the bookkeeping of every sequence.
+static size_t rowsSize(const std::vector<Sequence>& rows) {
+	size_t size = sizeof(rows) + rows.capacity() * sizeof(Sequence);
+	for (const auto& seq : rows) {
+		size += seq.id.capacity() + seq.data.capacity();
+	}
+	return size;
+}
+
+TileCache::TileCache(size_t capacity) : capacity(capacity), size(0), hits(0), misses(0) {
+}
+
+void TileCache::setCapacity(size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	capacity = bytes;
+	evict();
+}
+
+bool TileCache::enabled() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return capacity > 0;
+}
+
+TileRows TileCache::find(const TileKey& key, size_t rowCount) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = index.find(key);
+	if (it == index.end() || it->second->rows->size() < rowCount) {
+		++misses;
+		return TileRows();
+	}
+	++hits;
+	entries.splice(entries.begin(), entries, it->second);
+	return it->second->rows;
+}
+
+void TileCache::insert(const TileKey& key, const TileRows& rows) {
+	size_t rowsBytes = rowsSize(*rows);
+	std::lock_guard<std::mutex> lock(mutex);
+	auto it = index.find(key);
+	if (it != index.end()) {
+		size -= it->second->size;
+		entries.erase(it->second);
+		index.erase(it);
+	}
+	if (rowsBytes > capacity) {
+		return;
+	}
+	Entry entry = { key, rows, rowsBytes };
+	entries.push_front(entry);
+	index[key] = entries.begin();
+	size += rowsBytes;
+	evict();
+}
+
+void TileCache::evict() {
+	while (size > capacity && !entries.empty()) {
+		size -= entries.back().size;
+		index.erase(entries.back().key);
+		entries.pop_back();
+	}
+}
+
+uint64_t TileCache::hitCount() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return hits;
+}
+
+uint64_t TileCache::missCount() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return misses;
+}
@@ -0,0 +1,105 @@
+﻿#ifndef TILECACHE_HPP
+#define TILECACHE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <memory>
+
+struct Sequence;
+
+/**
+ * Identifies a decoded rectangle: the archive holding it and its index in the footer.
+ * The footer position tells apart successive archives written to the same path.
+ */
+struct TileKey {
+    std::string archive;                    // Path of the archive
+    uint64_t footerStart;                   // Position of the footer in the archive
+    size_t index;                           // Index of the rectangle in the footer
+
+    bool operator==(const TileKey& other) const {
+        return index == other.index && footerStart == other.footerStart && archive == other.archive;
+    }
+};
+
+struct TileKeyHash {
+    size_t operator()(const TileKey& key) const;
+};
+
+/**
+ * Decoded rows of a rectangle held by the cache, shared with the queries using them.
+ */
+typedef std::shared_ptr<const std::vector<Sequence>> TileRows;
+
+/**
+ * Thread-safe cache of decoded rectangles, evicting the least recently used ones beyond a capacity in bytes.
+ * A rectangle may be cached with only its first rows, as decoded by a query on them.
+ */
+class TileCache {
+private:
+    struct Entry {
+        TileKey key;                        // Rectangle held
+        TileRows rows;                      // Decoded rows of the rectangle
+        size_t size;                        // Number of bytes accounted for the rows
+    };
+
+    std::list<Entry> entries;                                                   // Cached rectangles, most recently used first
+    std::unordered_map<TileKey, std::list<Entry>::iterator, TileKeyHash> index; // Position of every cached rectangle in entries
+    size_t capacity;                                                            // Maximum number of bytes of cached rows, 0 disabling the cache
+    size_t size;                                                                // Number of bytes of cached rows
+    uint64_t hits;                                                              // Lookups answered from the cache
+    uint64_t misses;                                                            // Lookups that had to decode the rectangle
+    mutable std::mutex mutex;                                                   // Guards all the members above
+
+    /**
+     * Evicts the least recently used rectangles until the cached rows fit in the capacity.
+     */
+    void evict();
+
+public:
+
+    /**
+     * Creates an empty cache holding up to the given number of bytes of decoded rows.
+     */
+    explicit TileCache(size_t capacity = 0);
+
+    TileCache(const TileCache&) = delete;
+    TileCache& operator=(const TileCache&) = delete;
+
+    /**
+     * Changes the capacity, evicting rectangles if the cache holds more.
+     */
+    void setCapacity(size_t bytes);
+
+    /**
+     * Returns whether rectangles are cached at all.
+     */
+    bool enabled() const;
+
+    /**
+     * Returns the rows of a cached rectangle, or NULL when it is not cached with at least rowCount rows.
+     * Counts a hit or a miss.
+     */
+    TileRows find(const TileKey& key, size_t rowCount);
+
+    /**
+     * Caches the decoded rows of a rectangle, replacing any rows cached for it before.
+     * Rows larger than the whole capacity are not cached.
+     */
+    void insert(const TileKey& key, const TileRows& rows);
+
+    /**
+     * Returns the number of lookups answered from the cache.
+     */
+    uint64_t hitCount() const;
+
+    /**
+     * Returns the number of lookups that missed the cache.
+     */
+    uint64_t missCount() const;
+};
+
+#endif
@@ -0,0 +1,116 @@
+﻿#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#define ZSTD_STATIC_LINKING_ONLY
+#include "zstd_errors.h"
+#include "TileCodec.hpp"
+
+static size_t compressZstd(ZSTD_CCtx* cctx, const std::string& data, std::vector<char>& out) {
+	out.resize(ZSTD_compressBound(data.size()));
+	size_t result = ZSTD_compress2(cctx, out.data(), out.size(), data.data(), data.size());
+	out.resize(ZSTD_isError(result) ? 0 : result);
+	return result;
+}
+
+// Without any sequence every block holds the data as Huffman-coded literals, decoded without copying matches.
+size_t compressLiterals(ZSTD_CCtx* cctx, const std::string& data, std::vector<char>& out) {
+	out.resize(ZSTD_compressBound(data.size()));
+	size_t result = ZSTD_compressSequences(cctx, out.data(), out.size(), NULL, 0, data.data(), data.size());
+	out.resize(ZSTD_isError(result) ? 0 : result);
+	return result;
+}
+
+static unsigned long long zstdContentSize(const char* src, size_t size) {
+	return ZSTD_getFrameContentSize(src, size);
+}
+
+static size_t decompressZstd(ZSTD_DCtx* dctx, const ZSTD_DDict* dictionary, const char* src, size_t size, char* dst, size_t capacity) {
+	if (dictionary) {
+		return ZSTD_decompress_usingDDict(dctx, dst, capacity, src, size, dictionary);
+	}
+	return ZSTD_decompressDCtx(dctx, dst, capacity, src, size);
+}
+
+static size_t compressStored(ZSTD_CCtx*, const std::string& data, std::vector<char>& out) {
+	out.assign(data.begin(), data.end());
+	return out.size();
+}
+
+static unsigned long long storedContentSize(const char*, size_t size) {
+	return size;
+}
+
+static size_t decompressStored(ZSTD_DCtx*, const ZSTD_DDict*, const char* src, size_t size, char* dst, size_t capacity) {
+	if (size > capacity) {
+		return static_cast<size_t>(-ZSTD_error_dstSize_tooSmall);
+	}
+	std::memcpy(dst, src, size);
+	return size;
+}
+
+// Data made of one pattern repeated, such as a rectangle whose rows are all the same, is stored as the number
+// of repetitions (8 bytes) followed by the pattern. The data ends with the last byte of the pattern, so the only
+// candidate is the data up to the first occurrence of that byte, i.e. the first row of a rectangle.
+static size_t compressConstant(ZSTD_CCtx*, const std::string& data, std::vector<char>& out) {
+	out.clear();
+	if (data.empty()) {
+		return 0;
+	}
+	size_t patternSize = data.find(data.back()) + 1;
+	if (patternSize == data.size() || data.size() % patternSize != 0) {
+		return 0;
+	}
+	for (size_t position = patternSize; position < data.size(); position += patternSize) {
+		if (std::memcmp(data.data(), data.data() + position, patternSize) != 0) {
+			return 0;
+		}
+	}
+	uint64_t repetitions = data.size() / patternSize;
+	out.resize(sizeof(repetitions) + patternSize);
+	std::memcpy(out.data(), &repetitions, sizeof(repetitions));
+	std::memcpy(out.data() + sizeof(repetitions), data.data(), patternSize);
+	return out.size();
+}
+
+static unsigned long long constantContentSize(const char* src, size_t size) {
+	uint64_t repetitions;
+	if (size <= sizeof(repetitions)) {
+		return ZSTD_CONTENTSIZE_ERROR;
+	}
+	std::memcpy(&repetitions, src, sizeof(repetitions));
+	size_t patternSize = size - sizeof(repetitions);
+	if (repetitions > SIZE_MAX / patternSize) {
+		return ZSTD_CONTENTSIZE_ERROR;
+	}
+	return repetitions * patternSize;
+}
+
+static size_t decompressConstant(ZSTD_DCtx*, const ZSTD_DDict*, const char* src, size_t size, char* dst, size_t capacity) {
+	unsigned long long contentSize = constantContentSize(src, size);
+	if (contentSize == ZSTD_CONTENTSIZE_ERROR || contentSize > capacity) {
+		return static_cast<size_t>(-ZSTD_error_corruption_detected);
+	}
+	size_t patternSize = size - sizeof(uint64_t);
+	std::memcpy(dst, src + sizeof(uint64_t), patternSize);
+	// doubles the filled part until the whole output holds the pattern
+	for (size_t filled = patternSize; filled < contentSize; filled *= 2) {
+		std::memcpy(dst + filled, dst, std::min<size_t>(filled, contentSize - filled));
+	}
+	return contentSize;
+}
+
+// Indexed by TileCodec
+static const TileCodecKernels codecTable[] = {
+	{ compressZstd, zstdContentSize, decompressZstd, true },                // ZSTD_CODEC
+	{ compressStored, storedContentSize, decompressStored, false },         // STORED_CODEC
+	{ compressConstant, constantContentSize, decompressConstant, false }    // CONSTANT_CODEC
+};
+
+const TileCodecKernels* findTileCodec(TileCodec codec) {
+	size_t index = static_cast<size_t>(codec);
+	if (index >= sizeof(codecTable) / sizeof(codecTable[0])) {
+		return NULL;
+	}
+	return &codecTable[index];
+}
@@ -0,0 +1,43 @@
+﻿#ifndef TILECODEC_HPP
+#define TILECODEC_HPP
+
+#include <vector>
+#include <string>
+#include "zstd.h"
+#include "MSACompressor.hpp"
+
+/**
+ * Backend encoding the serialized data of a rectangle, chosen per rectangle and recorded in the footer.
+ * Backends writing Zstandard frames are given the contexts of the calling thread, already set up by the caller
+ * with the parameters and the dictionary or prefix of the rectangle. The others ignore the contexts.
+ * Filled and duplicate rectangles are resolved by the compressor and have no backend.
+ */
+struct TileCodecKernels {
+    /**
+     * Encodes the data into out. Returns the encoded size, a Zstandard error code, or 0 if the backend cannot encode this data.
+     */
+    size_t (*compress)(ZSTD_CCtx* cctx, const std::string& data, std::vector<char>& out);
+    /**
+     * Returns the size of the data encoded in src, ZSTD_CONTENTSIZE_ERROR or ZSTD_CONTENTSIZE_UNKNOWN if it cannot be determined.
+     */
+    unsigned long long (*contentSize)(const char* src, size_t size);
+    /**
+     * Decodes src into dst, decompressing Zstandard frames with the given dictionary (NULL for none or for a referenced prefix).
+     * Returns the decoded size or a Zstandard error code.
+     */
+    size_t (*decompress)(ZSTD_DCtx* dctx, const ZSTD_DDict* dictionary, const char* src, size_t size, char* dst, size_t capacity);
+    bool zstdFrame;                         // Encoded data is a Zstandard frame, which uses the contexts, the dictionary and the prefix
+};
+
+/**
+ * Encodes the data as a Zstandard frame of Huffman-coded literals only, decoded by the backend of ZSTD_CODEC.
+ * Returns the encoded size or a Zstandard error code.
+ */
+size_t compressLiterals(ZSTD_CCtx* cctx, const std::string& data, std::vector<char>& out);
+
+/**
+ * Returns the backend of the given codec, or NULL for an unknown value read from a damaged file.
+ */
+const TileCodecKernels* findTileCodec(TileCodec codec);
+
+#endif
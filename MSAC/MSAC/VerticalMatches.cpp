@@ -0,0 +1,248 @@
+﻿#include <algorithm>
+#include <cstring>
+#include "VerticalMatches.hpp"
+
+// Number of previous rows whose symbol at the same position is compared with the current one
+static const size_t VERTICAL_CANDIDATE_ROWS = 2;
+// Insertions and gap runs present in only some rows shift the rest of a row, after which the same position no longer
+// matches. The last position of every VERTICAL_HASH_BYTES symbols, kept in a table of 2^VERTICAL_HASH_LOG entries,
+// finds the row again.
+static const size_t VERTICAL_HASH_LOG = 14;
+static const size_t VERTICAL_HASH_BYTES = 4;
+// Number of last offsets tracked, as in Zstandard
+static const size_t VERTICAL_REPEAT_OFFSETS = 3;
+// Shortest match Zstandard accepts
+static const size_t VERTICAL_MIN_MATCH = 3;
+
+// Estimated costs, in bits, of the parts of a compressed block: a literal of a serialized alignment after Huffman
+// coding, the literal and match length codes of a sequence, and the offset code of a repeat offset and of a new
+// offset, the latter also taking as many extra bits as the offset has. A match is taken when it saves more than it costs.
+static const size_t LITERAL_BITS = 4;
+static const size_t SEQUENCE_BITS = 8;
+static const size_t REPEAT_OFFSET_BITS = 2;
+static const size_t NEW_OFFSET_BITS = 5;
+// A block is left to Zstandard's own match finders unless its matches save at least 1/FALLBACK_DIVISOR of its
+// literal cost: rows unlike the rows above them leave horizontal repeats, which only those find
+static const size_t FALLBACK_DIVISOR = 3;
+// A block whose first FALLBACK_PROBE_SIZE bytes save less than half of that is given up early
+static const size_t FALLBACK_PROBE_SIZE = 16 * 1024;
+// Levels at which the producer gives smaller output in less time than the level's own match finders. Below
+// VERTICAL_MIN_LEVEL they are faster, and from VERTICAL_MAX_LEVEL Zstandard's optimal parsers, pricing every match
+// they find, do better on all blocks.
+static const int VERTICAL_MIN_LEVEL = 10;
+static const int VERTICAL_MAX_LEVEL = 16;
+
+struct VerticalMatch {
+	size_t gain;                            // Estimated bits saved, 0 if no match pays for itself
+	size_t length;
+	size_t offset;
+	size_t repeatIndex;                     // Index of the offset among the last offsets, VERTICAL_REPEAT_OFFSETS for a new one
+};
+
+static size_t matchLength(const char* match, const char* current, const char* end) {
+	const char* start = current;
+	while (current + sizeof(size_t) <= end) {
+		size_t a, b;
+		std::memcpy(&a, match, sizeof(a));
+		std::memcpy(&b, current, sizeof(b));
+		if (a != b) {
+			break;
+		}
+		match += sizeof(size_t);
+		current += sizeof(size_t);
+	}
+	while (current < end && *match == *current) {
+		++match;
+		++current;
+	}
+	return current - start;
+}
+
+static size_t hashPosition(const char* data) {
+	uint32_t value;
+	std::memcpy(&value, data, sizeof(value));
+	return (value * 2654435761u) >> (32 - VERTICAL_HASH_LOG);
+}
+
+static size_t offsetBits(size_t offset) {
+	size_t bits = NEW_OFFSET_BITS;
+	while (offset > 1) {
+		offset >>= 1;
+		++bits;
+	}
+	return bits;
+}
+
+// Bits saved by a match of the given length, or 0 if it costs more than the literals it replaces
+static size_t matchGain(size_t length, size_t cost) {
+	size_t literals = length * LITERAL_BITS;
+	return length >= VERTICAL_MIN_MATCH && literals > cost + SEQUENCE_BITS ? literals - cost - SEQUENCE_BITS : 0;
+}
+
+// Returns the row holding the given position, searching forward from row
+static size_t advanceRow(const std::vector<size_t>& rowStarts, size_t row, size_t pos) {
+	while (pos >= rowStarts[row + 1]) {
+		++row;
+	}
+	return row;
+}
+
+// Finds the match at pos saving the most: one of the last offsets, the same position of the previous rows, or the
+// last position starting with the same symbols, which is then replaced by pos
+static VerticalMatch findMatch(VerticalMatchState& state, size_t pos, size_t row, size_t end, size_t windowSize) {
+	const char* data = state.input;
+	const std::vector<size_t>& rowStarts = state.rowStarts;
+	VerticalMatch best = { 0, 0, 0, VERTICAL_REPEAT_OFFSETS };
+	for (size_t i = 0; i < VERTICAL_REPEAT_OFFSETS; ++i) {
+		size_t offset = state.repeatOffsets[i];
+		if (offset <= pos) {
+			size_t length = matchLength(data + pos - offset, data + pos, data + end);
+			size_t gain = matchGain(length, REPEAT_OFFSET_BITS);
+			if (gain > best.gain) {
+				VerticalMatch match = { gain, length, offset, i };
+				best = match;
+			}
+		}
+	}
+
+	size_t candidates[VERTICAL_CANDIDATE_ROWS + 1];
+	size_t candidateCount = 0;
+	size_t column = pos - rowStarts[row];
+	for (size_t previous = 1; previous <= VERTICAL_CANDIDATE_ROWS && previous <= row; ++previous) {
+		size_t candidate = rowStarts[row - previous] + column;
+		if (candidate < rowStarts[row - previous + 1]) {
+			candidates[candidateCount++] = candidate;
+		}
+	}
+	if (pos + VERTICAL_HASH_BYTES <= end) {
+		uint32_t& entry = state.hashTable[hashPosition(data + pos)];
+		if (entry != 0 && entry - 1 < pos) {
+			candidates[candidateCount++] = entry - 1;
+		}
+		entry = static_cast<uint32_t>(pos + 1);
+	}
+	for (size_t i = 0; i < candidateCount; ++i) {
+		size_t offset = pos - candidates[i];
+		if (offset > windowSize || offset == best.offset) {
+			continue;
+		}
+		size_t length = matchLength(data + candidates[i], data + pos, data + end);
+		// a match too short to beat the best one even at the cheapest new offset is not priced
+		if (length * LITERAL_BITS <= best.gain + SEQUENCE_BITS + NEW_OFFSET_BITS) {
+			continue;
+		}
+		size_t gain = matchGain(length, offsetBits(offset));
+		if (gain > best.gain) {
+			VerticalMatch match = { gain, length, offset, VERTICAL_REPEAT_OFFSETS };
+			best = match;
+		}
+	}
+	return best;
+}
+
+bool verticalMatchesPay(int compressionLevel) {
+	return compressionLevel >= VERTICAL_MIN_LEVEL && compressionLevel < VERTICAL_MAX_LEVEL;
+}
+
+void beginVerticalMatchFrame(VerticalMatchState& state, const char* input, size_t size) {
+	state.input = input;
+	state.inputSize = size;
+	state.rowStarts.clear();
+	state.rowStarts.push_back(0);
+	const char* end = input + size;
+	for (const char* separator = input; (separator = static_cast<const char*>(std::memchr(separator, '#', end - separator))) != NULL; ++separator) {
+		state.rowStarts.push_back(separator - input + 1);
+	}
+	state.rowStarts.push_back(size + 1);
+	state.hashTable.assign(size_t(1) << VERTICAL_HASH_LOG, 0);
+	state.repeatOffsets[0] = 1;
+	state.repeatOffsets[1] = 4;
+	state.repeatOffsets[2] = 8;
+}
+
+size_t produceVerticalMatches(void* sequenceProducerState, ZSTD_Sequence* outSeqs, size_t outSeqsCapacity,
+	const void* src, size_t srcSize, const void* /*dict*/, size_t /*dictSize*/, int compressionLevel, size_t windowSize) {
+	if (!verticalMatchesPay(compressionLevel)) {
+		return ZSTD_SEQUENCE_PRODUCER_ERROR;
+	}
+	VerticalMatchState* state = static_cast<VerticalMatchState*>(sequenceProducerState);
+	const char* block = static_cast<const char*>(src);
+	if (state->input == NULL || block < state->input || block + srcSize > state->input + state->inputSize) {
+		// a block of an input not announced by beginVerticalMatchFrame, which may start in the middle of a row
+		beginVerticalMatchFrame(*state, block, srcSize);
+	}
+	size_t blockStart = block - state->input;
+	size_t blockEnd = blockStart + srcSize;
+	const std::vector<size_t>& rowStarts = state->rowStarts;
+	size_t* repeatOffsets = state->repeatOffsets;
+
+	size_t sequenceCount = 0;
+	size_t literalStart = blockStart;
+	size_t savedBits = 0;
+	size_t pos = std::max<size_t>(blockStart, 1);
+	size_t row = std::upper_bound(rowStarts.begin(), rowStarts.end(), pos) - rowStarts.begin() - 1;
+	VerticalMatch match = { 0, 0, 0, VERTICAL_REPEAT_OFFSETS };
+	bool searched = false;
+	bool probed = false;
+	while (pos + VERTICAL_MIN_MATCH <= blockEnd) {
+		if (!probed && pos - blockStart >= FALLBACK_PROBE_SIZE) {
+			if (savedBits * FALLBACK_DIVISOR * 2 < (pos - blockStart) * LITERAL_BITS) {
+				return ZSTD_SEQUENCE_PRODUCER_ERROR;
+			}
+			probed = true;
+		}
+		if (!searched) {
+			match = findMatch(*state, pos, row, blockEnd, windowSize);
+		}
+		searched = false;
+		if (match.gain == 0) {
+			row = advanceRow(rowStarts, row, ++pos);
+			continue;
+		}
+		// a match starting at the next symbol replaces this one if it saves more than the literal it leaves
+		if (pos + 1 + VERTICAL_MIN_MATCH <= blockEnd) {
+			size_t nextRow = advanceRow(rowStarts, row, pos + 1);
+			VerticalMatch next = findMatch(*state, pos + 1, nextRow, blockEnd, windowSize);
+			if (next.gain > match.gain + LITERAL_BITS) {
+				++pos;
+				row = nextRow;
+				match = next;
+				searched = true;
+				continue;
+			}
+		}
+
+		// a new offset pushes out the oldest one, a repeat offset moves to the front
+		size_t shifted = std::min(match.repeatIndex, VERTICAL_REPEAT_OFFSETS - 1);
+		std::memmove(repeatOffsets + 1, repeatOffsets, shifted * sizeof(size_t));
+		repeatOffsets[0] = match.offset;
+		savedBits += match.gain;
+
+		if (sequenceCount + 1 >= outSeqsCapacity) {
+			return ZSTD_SEQUENCE_PRODUCER_ERROR;
+		}
+		ZSTD_Sequence& sequence = outSeqs[sequenceCount++];
+		sequence.offset = static_cast<unsigned>(match.offset);
+		sequence.litLength = static_cast<unsigned>(pos - literalStart);
+		sequence.matchLength = static_cast<unsigned>(match.length);
+		sequence.rep = 0;
+		pos += match.length;
+		literalStart = pos;
+		row = advanceRow(rowStarts, row, pos);
+	}
+
+	if (savedBits * FALLBACK_DIVISOR < srcSize * LITERAL_BITS) {
+		return ZSTD_SEQUENCE_PRODUCER_ERROR;
+	}
+
+	// the last sequence carries the remaining literals
+	if (sequenceCount >= outSeqsCapacity) {
+		return ZSTD_SEQUENCE_PRODUCER_ERROR;
+	}
+	ZSTD_Sequence& last = outSeqs[sequenceCount++];
+	last.offset = 0;
+	last.litLength = static_cast<unsigned>(blockEnd - literalStart);
+	last.matchLength = 0;
+	last.rep = 0;
+	return sequenceCount;
+}
@@ -0,0 +1,54 @@
+﻿#ifndef VERTICALMATCHES_HPP
+#define VERTICALMATCHES_HPP
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#define ZSTD_STATIC_LINKING_ONLY
+#include "zstd.h"
+
+/**
+ * Block-level sequence producer for Zstandard that finds the matches typical of serialized rectangles.
+ * In a rectangle written row by row (rows separated by '#'), a symbol most often repeats the symbol at the same
+ * position of one of the previous rows, so instead of hashing, each position is only compared with the same position
+ * of the last few rows and with the previous symbol (runs of gaps). The offsets found this way repeat from one match
+ * to the next, so Zstandard encodes most of them as repeat offsets.
+ */
+
+/**
+ * State of the producer, one per compression context. Zstandard hands the producer one block at a time, so the state
+ * keeps the input of the whole frame: rows crossing a block boundary are then compared with the rows above them, and
+ * the last offsets carry over from one block to the next.
+ */
+struct VerticalMatchState {
+    const char* input;                      // Input of the frame being compressed, NULL before the first frame
+    size_t inputSize;                       // Size of the input
+    std::vector<size_t> rowStarts;          // Start of each row of the input, then one past its end
+    std::vector<uint32_t> hashTable;        // Last position (plus one, 0 for none) of each hash of a few symbols
+    size_t repeatOffsets[3];                // Offsets of the last matches, most recent first
+
+    VerticalMatchState() : input(NULL), inputSize(0), repeatOffsets() {
+    }
+};
+
+/**
+ * Returns whether the producer is worth registering at a compression level, i.e. whether it compresses serialized
+ * rectangles better and faster than the level's own match finders. It is only meant for levels 10 to 15.
+ */
+bool verticalMatchesPay(int compressionLevel);
+
+/**
+ * Prepares the state for a frame compressed from the given input in one call, e.g. by ZSTD_compress2, whose blocks are
+ * then consecutive parts of the input. Blocks outside the input are parsed on their own.
+ */
+void beginVerticalMatchFrame(VerticalMatchState& state, const char* input, size_t size);
+
+/**
+ * Sequence producer registered with ZSTD_registerSequenceProducer, taking a VerticalMatchState as its state.
+ * A block on which vertical matches save too little is left to Zstandard's own match finders, by returning an error
+ * with the fallback enabled.
+ */
+size_t produceVerticalMatches(void* sequenceProducerState, ZSTD_Sequence* outSeqs, size_t outSeqsCapacity,
+    const void* src, size_t srcSize, const void* dict, size_t dictSize, int compressionLevel, size_t windowSize);
+
+#endif
@@ -0,0 +1,95 @@
+﻿#include <iostream>
+#include <cstdlib>
+#include "VerticalMatches.hpp"
+#include "ZstdContext.hpp"
+
+namespace {
+
+struct ThreadContexts {
+	ZSTD_CCtx* cctx;
+	ZSTD_DCtx* dctx;
+	ZstdParameters parameters;
+	bool parametersSet;
+	int windowLogMax;
+	VerticalMatchState verticalMatchState;
+
+	ThreadContexts() : cctx(NULL), dctx(NULL), parameters(), parametersSet(false), windowLogMax(0) {
+	}
+
+	~ThreadContexts() {
+		ZSTD_freeCCtx(cctx);
+		ZSTD_freeDCtx(dctx);
+	}
+};
+
+thread_local ThreadContexts contexts;
+
+}
+
+static void setCompressionParameter(ZSTD_cParameter parameter, int value, const char* name) {
+	size_t result = ZSTD_CCtx_setParameter(contexts.cctx, parameter, value);
+	if (ZSTD_isError(result)) {
+		std::cerr << "Error: Invalid " << name << " " << value << ": " << ZSTD_getErrorName(result) << std::endl;
+		exit(1);
+	}
+}
+
+ZSTD_CCtx* threadCompressionContext(const ZstdParameters& parameters) {
+	if (contexts.cctx == NULL) {
+		contexts.cctx = ZSTD_createCCtx();
+		if (contexts.cctx == NULL) {
+			std::cerr << "Error: Unable to create a compression context." << std::endl;
+			exit(1);
+		}
+	}
+	if (!contexts.parametersSet || !(contexts.parameters == parameters)) {
+		ZSTD_CCtx_reset(contexts.cctx, ZSTD_reset_parameters);
+		setCompressionParameter(ZSTD_c_compressionLevel, parameters.level, "compression level");
+		if (parameters.windowLog != 0) {
+			setCompressionParameter(ZSTD_c_windowLog, parameters.windowLog, "window log");
+		}
+		if (parameters.strategy != 0) {
+			setCompressionParameter(ZSTD_c_strategy, parameters.strategy, "strategy");
+		}
+		if (parameters.literalsOnly) {
+			setCompressionParameter(ZSTD_c_literalCompressionMode, ZSTD_ps_enable, "literal compression mode");
+		}
+		else if (parameters.verticalMatches) {
+			// zstd's own match finders take over for any block the producer fails on
+			setCompressionParameter(ZSTD_c_enableLongDistanceMatching, ZSTD_ps_disable, "long distance matching");
+			ZSTD_registerSequenceProducer(contexts.cctx, &contexts.verticalMatchState, produceVerticalMatches);
+			setCompressionParameter(ZSTD_c_enableSeqProducerFallback, 1, "sequence producer fallback");
+			// the producer leaves repeat offsets to zstd, which only looks for them from level 10 by default
+			setCompressionParameter(ZSTD_c_searchForExternalRepcodes, ZSTD_ps_enable, "repeat offset search");
+		}
+		else if (parameters.longDistanceMatching) {
+			setCompressionParameter(ZSTD_c_enableLongDistanceMatching, ZSTD_ps_enable, "long distance matching");
+		}
+		contexts.parameters = parameters;
+		contexts.parametersSet = true;
+	}
+	return contexts.cctx;
+}
+
+void prepareVerticalMatches(const std::string& input) {
+	beginVerticalMatchFrame(contexts.verticalMatchState, input.data(), input.size());
+}
+
+ZSTD_DCtx* threadDecompressionContext(int windowLogMax) {
+	if (contexts.dctx == NULL) {
+		contexts.dctx = ZSTD_createDCtx();
+		if (contexts.dctx == NULL) {
+			std::cerr << "Error: Unable to create a decompression context." << std::endl;
+			exit(1);
+		}
+	}
+	if (contexts.windowLogMax != windowLogMax) {
+		size_t result = ZSTD_DCtx_setParameter(contexts.dctx, ZSTD_d_windowLogMax, windowLogMax);
+		if (ZSTD_isError(result)) {
+			std::cerr << "Error: Invalid window log " << windowLogMax << ": " << ZSTD_getErrorName(result) << std::endl;
+			exit(1);
+		}
+		contexts.windowLogMax = windowLogMax;
+	}
+	return contexts.dctx;
+}
@@ -0,0 +1,73 @@
+﻿#ifndef ZSTDCONTEXT_HPP
+#define ZSTDCONTEXT_HPP
+
+#include <memory>
+#include <string>
+#include "zstd.h"
+
+/**
+ * Long-lived Zstandard contexts, one of each kind per thread.
+ * Contexts are created on first use, reused for every rectangle the thread processes and freed when the thread exits,
+ * so compressing or decompressing a small rectangle does not pay for allocating and initializing a context.
+ */
+
+/**
+ * Deleters releasing digested dictionaries held by CompressionDictionary and DecompressionDictionary.
+ */
+struct CompressionDictionaryDeleter {
+    void operator()(ZSTD_CDict* dictionary) const {
+        ZSTD_freeCDict(dictionary);
+    }
+};
+
+struct DecompressionDictionaryDeleter {
+    void operator()(ZSTD_DDict* dictionary) const {
+        ZSTD_freeDDict(dictionary);
+    }
+};
+
+/**
+ * Dictionaries digested once and then shared, read-only, by all threads compressing or decompressing rectangles.
+ */
+typedef std::unique_ptr<ZSTD_CDict, CompressionDictionaryDeleter> CompressionDictionary;
+typedef std::unique_ptr<ZSTD_DDict, DecompressionDictionaryDeleter> DecompressionDictionary;
+
+/**
+ * Structure holding the Zstandard parameters of a compression, recorded in the archive.
+ */
+struct ZstdParameters {
+    int level;                              // Compression level, negative for the fast levels, 20 to 22 for the ultra levels
+    int windowLog;                          // Base-2 logarithm of the window size, 0 to let the level choose
+    int strategy;                           // Match finding strategy (ZSTD_strategy), 0 to let the level choose
+    bool longDistanceMatching;              // Whether long distance matching is enabled
+    bool verticalMatches;                   // Whether the vertical match producer replaces zstd's match finders
+    bool literalsOnly;                      // Whether data is compressed as literals only, always Huffman-coded (not recorded)
+
+    bool operator==(const ZstdParameters& other) const {
+        return level == other.level && windowLog == other.windowLog && strategy == other.strategy
+            && longDistanceMatching == other.longDistanceMatching && verticalMatches == other.verticalMatches
+            && literalsOnly == other.literalsOnly;
+    }
+};
+
+/**
+ * Returns the compression context of the calling thread with the given parameters applied.
+ * Parameters are sticky, so they are only applied again when they change.
+ * Long distance matching is left disabled with the vertical match producer, which Zstandard cannot combine with it.
+ * For literals only, no match finding is set up and literals are compressed even at the fast levels.
+ */
+ZSTD_CCtx* threadCompressionContext(const ZstdParameters& parameters);
+
+/**
+ * Tells the vertical match producer of the calling thread the input of the next frame, so that it can match rows
+ * of the earlier blocks of the frame.
+ */
+void prepareVerticalMatches(const std::string& input);
+
+/**
+ * Returns the decompression context of the calling thread, accepting windows of up to 2^windowLogMax bytes
+ * (0 for Zstandard's default limit).
+ */
+ZSTD_DCtx* threadDecompressionContext(int windowLogMax);
+
+#endif
@@ -0,0 +1,8 @@
+/*
+ * Builds the libdivsufsort-lite copy of the zstd tree for the Burrows-Wheeler preprocessing.
+ * Its functions are renamed as declared in divsufsort.h, so they cannot clash with the copy
+ * that libzstd's dictionary builder links into a static libzstd.
+ */
+#define divsufsort msac_divsufsort
+#define divbwt msac_divbwt
+#include "../../zstd/zstd-dev/lib/dictBuilder/divsufsort.c"